@@ -10,105 +10,281 @@
 #include <JuceHeader.h>
 #include "DelayLine.h"
 
-void DelayLine::setMaximumDelayInSamples(int maxLengthInSamples){
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::setMaximumDelayInSamples(int maxLengthInSamples){
     jassert(maxLengthInSamples > 0);
     int paddedLength = maxLengthInSamples + 1; // If buffer was 5 samples, max delay would be 4
+    paddedLength += guardLength;               // Room for the older points of the interpolation
+    paddedLength = juce::nextPowerOfTwo(paddedLength); // Lets the indices wrap around with a mask
+    // Only ever grows, so going back & forth between sample rates reuses the memory
     if(bufferLength < paddedLength){
         bufferLength = paddedLength;
-        buffer.reset(new float[size_t(bufferLength)]);
+        mask = bufferLength - 1;
+        
+        int pageLength = std::min(bufferLength, 1 << maxPageShift);
+        int numPages = bufferLength / pageLength;
+        pageShift = juce::roundToInt(std::log2(pageLength));
+        pageMask = pageLength - 1;
+        pageStride = (pageLength + guardLength) * wordsPerSample;
+        
+        // malloc() doesn't touch the memory, so only the pages that get committed take up physical memory
+        pool.malloc(size_t(numPages * pageStride));
+        silence.calloc(size_t(pageStride));  // all bits zero is 0.0 in every storage format
+        pageTable.assign(size_t(numPages), silence.get());
+        freePages.clear();
+        freePages.reserve(size_t(numPages));
+        for(int page = numPages - 1; page >= 0; --page)
+            freePages.push_back(pool.get() + page * pageStride);
+        numCommitted = 0;
     }
 }
 
 // Clear out old data from the delay line
-void DelayLine::reset() noexcept{
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::reset() noexcept{
     writeIndex = bufferLength - 1;
-    for(size_t i = 0; i < size_t(bufferLength); ++i)
-        buffer[i] = 0.0;
-}
-
-void DelayLine::write(float sample) noexcept{
-    jassert(bufferLength > 0);
-    writeIndex = (writeIndex + 1) % bufferLength;
-    buffer[writeIndex] = sample;
+    
+    // Only hands back the pages that were written to, they're cleared when they're committed again.
+    // They go on top of the pool, so the pages that were never touched stay out of physical memory
+    int numPages = int(pageTable.size());
+    for(int i = 0; i < numCommitted; ++i){
+        auto& page = pageTable[size_t((oldestPage + i) & (numPages - 1))];
+        freePages.push_back(page);
+        page = silence.get();
+    }
+    numCommitted = 0;
+    oldestPage = 0;
+    storage.reset();
 }
 
-/*          Nearest neibhboring sample approach
-float DelayLine::read(float delayInSamples) const noexcept{
-    jassert(delayInSamples >= 0.0f);
-    jassert(delayInSamples < bufferLength);
-    int readIndex = std::round(writeIndex - delayInSamples);  // Nearest neighbor interpolation
-    if(readIndex < 0)
-        readIndex += bufferLength;
-    return buffer[size_t(readIndex)];
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::releaseOlderThan(int delayInSamples) noexcept{
+    int numPages = int(pageTable.size());
+    
+    // The page that holds the write head always stays
+    while(numCommitted > 1){
+        int newestInPage = (oldestPage << pageShift) + pageMask;
+        int age = (writeIndex - newestInPage) & mask;
+        if(age <= delayInSamples + guardLength)
+            break;
+        
+        freePages.push_back(pageTable[size_t(oldestPage)]);
+        pageTable[size_t(oldestPage)] = silence.get();
+        oldestPage = (oldestPage + 1) & (numPages - 1);
+        --numCommitted;
+    }
 }
-*/
 
-// Linear interpolation approach
-float DelayLine::read(float delayInSamples) const noexcept{
-    jassert(delayInSamples >= 0.0f);
-    jassert(delayInSamples <= bufferLength - 1.0f);
-    
-    int integer_delay = int(delayInSamples); // Strips out fractional component
-    float fraction = delayInSamples - float(integer_delay);
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::commit(int page) noexcept{
+    int numPages = int(pageTable.size());
+    if(pageTable[size_t(page)] != silence.get()){
+        // The write head went all the way around & is back in the oldest page, the next one is oldest now
+        if(page == oldestPage && numCommitted > 1)
+            oldestPage = (page + 1) & (numPages - 1);
+        return;
+    }
     
-    int readIndexA = writeIndex - integer_delay;
-    int readIndexB = writeIndex - integer_delay - 1;
+    // Pages are committed in the order the write head reaches them. The first one also needs the page
+    // before it, as reads that start at the end of that page take their newer points from its guard.
+    if(numCommitted == 0){
+        oldestPage = (page - 1) & (numPages - 1);
+        if(oldestPage != page)
+            takePage(oldestPage);
+    }
+    takePage(page);
     
-    if(readIndexA < 0) readIndexA += bufferLength;
-    if(readIndexB < 0) readIndexB += bufferLength;
+    // The guard of this page mirrors the start of the next one, which may hold samples already
+    updateGuard((page + 1) & (numPages - 1));
+}
+
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::takePage(int page) noexcept{
+    jassert(!freePages.empty());  // there's a page in the pool for every page of the buffer
+    Cell* memory = freePages.back();
+    freePages.pop_back();
+    juce::zeromem(memory, sizeof(Cell) * size_t(pageStride));  // all bits zero is 0.0 in every storage format
+    pageTable[size_t(page)] = memory;
+    ++numCommitted;
+}
+
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::write(SampleType sample) noexcept{
+    jassert(bufferLength > 0);
+    writeIndex = (writeIndex + 1) & mask;
+    commit(writeIndex >> pageShift);
+    store(&sample, writeIndex, 1);
+    if((writeIndex & pageMask) < guardLength)
+        updateGuard(writeIndex >> pageShift);
+}
+
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::writeBlock(const SampleType* input, int numSamples) noexcept{
+    jassert(bufferLength > 0);
+    jassert(numSamples <= bufferLength);
     
-    float sampleA = buffer[readIndexA];
-    float sampleB = buffer[readIndexB];
+    // Copy up to the end of each page, then carry on in the next one (wrapping around to the first page)
+    int index = (writeIndex + 1) & mask;
+    while(numSamples > 0){
+        int page = index >> pageShift;
+        int span = std::min(numSamples, pageMask + 1 - (index & pageMask));
+        commit(page);
+        store(input, index, span);
+        if((index & pageMask) < guardLength)
+            updateGuard(page);
+        
+        input += span;
+        numSamples -= span;
+        writeIndex = (index + span - 1) & mask;
+        index = (writeIndex + 1) & mask;
+    }
+}
+
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::fadeOut(int numSamples) noexcept{
+    jassert(numSamples >= 0 && numSamples < bufferLength);
+    float step = 1.0f / float(std::max(numSamples, 1));
     
-    return sampleA + fraction * (sampleB - sampleA);
+    int index = (writeIndex + 1 - numSamples) & mask;
+    for(int i = 0; i < numSamples;){
+        int page = index >> pageShift;
+        int span = std::min(numSamples - i, pageMask + 1 - (index & pageMask));
+        Cell* destination = pageTable[size_t(page)] + (index & pageMask) * wordsPerSample;
+        if(pageTable[size_t(page)] != silence.get()){  // the silent page stays silent
+            if constexpr (Storage::isExact){
+                for(int j = 0; j < span; ++j)
+                    destination[j] *= 1.0f - float(i + j + 1) * step;
+            }
+            else{
+                constexpr int maxUnpacked = 64;
+                SampleType unpacked[maxUnpacked];
+                for(int done = 0; done < span; done += maxUnpacked){
+                    int count = std::min(maxUnpacked, span - done);
+                    Cell* cells = destination + done * wordsPerSample;
+                    Storage::unpack(cells, reinterpret_cast<float*>(unpacked), count * wordsPerSample);
+                    for(int j = 0; j < count; ++j)
+                        unpacked[j] *= 1.0f - float(i + done + j + 1) * step;
+                    storage.pack(reinterpret_cast<const float*>(unpacked), cells, count * wordsPerSample);
+                }
+            }
+            if((index & pageMask) < guardLength)
+                updateGuard(page);
+        }
+        i += span;
+        index = (index + span) & mask;
+    }
 }
 
-/* Hermite (4 pts) Interpolation
-float DelayLine::read(float delayInSamples) const noexcept{
-    jassert(delayInSamples >= 1.0f);
-    jassert(delayInSamples <= bufferLength - 2.0f);
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::readSpan(SampleType* output, int delayInSamples, int numSamples) const noexcept{
+    jassert(bufferLength > 0);
+    jassert(delayInSamples >= numSamples && delayInSamples < bufferLength);  // written & not overwritten
     
-    int integerDelay = int(delayInSamples);
+    int index = (writeIndex + 1 - delayInSamples) & mask;
+    for(int i = 0; i < numSamples;){
+        int span = std::min(numSamples - i, pageMask + 1 - (index & pageMask));
+        const Cell* source = cell(index);
+        if constexpr (Storage::isExact)
+            std::copy(source, source + span, output + i);
+        else
+            Storage::unpack(source, reinterpret_cast<float*>(output + i), span * wordsPerSample);
+        i += span;
+        index = (index + span) & mask;
+    }
+}
+
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::readReverse(SampleType* output, int delayInSamples, int numSamples) const noexcept{
+    jassert(bufferLength > 0);
+    jassert(delayInSamples >= 1 && delayInSamples + numSamples <= bufferLength);  // written & not overwritten
     
-    // Get the 4 indices
-    // 2 samples to the right
-    int readIndexA = writeIndex - integerDelay + 1;
-    int readIndexB = readIndexA - 1;
-    // 2 samples to the left
-    int readIndexC = readIndexA - 2;
-    int readIndexD = readIndexA - 3;
+    // Sample i reads index writeIndex + 1 - delay - i, down to the start of each page & on at the end of the one before
+    int index = (writeIndex + 1 - delayInSamples) & mask;
+    for(int i = 0; i < numSamples;){
+        int span = std::min(numSamples - i, (index & pageMask) + 1);
+        const Cell* newest = cell(index);
+        if constexpr (Storage::isExact){
+            for(int j = 0; j < span; ++j)
+                output[i + j] = newest[-j];
+        }
+        else{
+            // Unpack a little at a time, newest first, & turn every piece around
+            constexpr int maxUnpacked = 64;
+            SampleType unpacked[maxUnpacked];
+            for(int done = 0; done < span; done += maxUnpacked){
+                int count = std::min(maxUnpacked, span - done);
+                Storage::unpack(newest - (done + count - 1) * wordsPerSample, reinterpret_cast<float*>(unpacked),
+                                count * wordsPerSample);
+                for(int j = 0; j < count; ++j)
+                    output[i + done + j] = unpacked[count - 1 - j];
+            }
+        }
+        i += span;
+        index = (index - span) & mask;
+    }
+}
+
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::addTaps(SampleType* output, const int* delaysInSamples, const SampleType* startGains,
+                                             const SampleType* endGains, int numTaps, int numSamples) const noexcept{
+    jassert(bufferLength > 0);
+    float rampStep = 1.0f / float(numSamples);
     
-    //   Wrap-around indices
-    // Point D is the smallest index. If its not negative none of the points need to wrapped around
-    if(readIndexD < 0){
-        readIndexD += bufferLength;
-        if(readIndexC < 0){
-            readIndexC += bufferLength;
-            if(readIndexB < 0){
-                readIndexB += bufferLength;
-                if(readIndexA < 0){
-                    readIndexA += bufferLength;
+    for(int tap = 0; tap < numTaps; ++tap){
+        jassert(delaysInSamples[tap] >= numSamples && delaysInSamples[tap] < bufferLength);  // written & not overwritten
+        SampleType start = startGains[tap];
+        SampleType step = (endGains[tap] - start) * rampStep;
+        
+        // Sample i reads index writeIndex + i + 1 - delay, up to the end of each page & on in the next one
+        int index = (writeIndex + 1 - delaysInSamples[tap]) & mask;
+        for(int i = 0; i < numSamples;){
+            int span = std::min(numSamples - i, pageMask + 1 - (index & pageMask));
+            const Cell* source = cell(index);
+            if constexpr (Storage::isExact){
+                for(int j = 0; j < span; ++j)
+                    output[i + j] += source[j] * (start + step * float(i + j + 1));
+            }
+            else{
+                // Unpack a little at a time, into a buffer that stays in the cache
+                constexpr int maxUnpacked = 64;
+                SampleType unpacked[maxUnpacked];
+                for(int done = 0; done < span; done += maxUnpacked){
+                    int count = std::min(maxUnpacked, span - done);
+                    Storage::unpack(source + done * wordsPerSample, reinterpret_cast<float*>(unpacked), count * wordsPerSample);
+                    for(int j = 0; j < count; ++j)
+                        output[i + done + j] += unpacked[j] * (start + step * float(i + done + j + 1));
                 }
             }
+            i += span;
+            index = (index + span) & mask;
         }
     }
-    
-    // Get the 4 samples
-    float sampleA = buffer[size_t(readIndexA)];
-    float sampleB = buffer[size_t(readIndexB)];
-    float sampleC = buffer[size_t(readIndexC)];
-    float sampleD = buffer[size_t(readIndexD)];
-    
-    // Create the curve throug the 4 samples and find the interpolated value
-    float fraction = delayInSamples - float(integerDelay);
-    float slope0 = (sampleC - sampleA) * 0.5f;
-    float slope1 = (sampleD - sampleB) * 0.5f;
-    float v = sampleB - sampleC;
-    float w = slope0 + v;
-    float a = w + v + slope1;
-    float b = w + a;
-    float stage1 = a * fraction - b;
-    float stage2 = stage1 * fraction + slope0;
-    return stage2 * fraction + sampleB;
 }
-*/
+
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::store(const SampleType* input, int index, int numSamples) noexcept{
+    Cell* destination = pageTable[size_t(index >> pageShift)] + (index & pageMask) * wordsPerSample;
+    if constexpr (Storage::isExact)
+        std::copy(input, input + numSamples, destination);
+    else
+        storage.pack(reinterpret_cast<const float*>(input), destination, numSamples * wordsPerSample);
+}
+
+template<typename SampleType, typename Storage>
+void DelayLine<SampleType, Storage>::updateGuard(int page) noexcept{
+    // Copies the stored cells, so packed samples aren't packed (& dithered) a second time
+    int numPages = int(pageTable.size());
+    Cell* previous = pageTable[size_t((page - 1) & (numPages - 1))];
+    if(previous == silence.get())
+        return;  // nothing reads the guard of a page that isn't committed
+    const Cell* first = pageTable[size_t(page)];
+    std::copy(first, first + guardLength * wordsPerSample, previous + (pageMask + 1) * wordsPerSample);
+}
+
+// The sample types & storage formats the plug-in uses, the member functions above are compiled for these
+template class DelayLine<float>;
+template class DelayLine<StereoSample>;
+template class DelayLine<float, DelayStorage::Half>;
+template class DelayLine<StereoSample, DelayStorage::Half>;
+template class DelayLine<float, DelayStorage::Dithered16>;
+template class DelayLine<StereoSample, DelayStorage::Dithered16>;
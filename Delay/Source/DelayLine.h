@@ -7,14 +7,25 @@
     The most important difference is that there is no specific function to set
     the delay. Rather, delay length is specified when "read" is called
 
+    The length is a power of two, so an index wraps around with a bitwise AND. The buffer is cut into
+    pages that are committed (taken from the pool & cleared) when the write head reaches them & handed
+    back with releaseOlderThan(), so a long maximum delay only costs memory while it's in use. Each page
+    mirrors its first few samples at the end of the one before it, so interpolation points are contiguous.
+    Templates on the sample type (float or StereoSample) & on the storage, see DelayStorage.h.
 
   ==============================================================================
 */
 
 #pragma once
 
-#include <memory>
+#include <JuceHeader.h>
+#include <type_traits>
+#include <vector>
+#include "DelayStorage.h"
+#include "Interpolation.h"
+#include "StereoSample.h"
 
+template<typename SampleType, typename Storage = DelayStorage::Float>
 class DelayLine
 {
 public:
@@ -23,22 +34,209 @@ public:
      */
     void setMaximumDelayInSamples(int maxLengthInSamples);
     
-    /** Clears the delay line and resets all state. This should be called before first usage. */
+    /** Clears the delay line and resets all state. This should be called before first usage.
+        Hands every page back to the pool, the pages are cleared when they're committed again. */
     void reset() noexcept;
     
-    /** Returns the maximum delay length in samples. */
+    /** Hands back the pages that only hold samples more than delayInSamples old.
+        Reading further back than that returns silence until the write head has been there again.
+     */
+    void releaseOlderThan(int delayInSamples) noexcept;
+    
+    /** Number of pages that are in use, out of getNumPages(). */
+    int getNumCommittedPages() const noexcept{
+        return numCommitted;
+    }
+    int getNumPages() const noexcept{
+        return int(pageTable.size());
+    }
+    
+    /** Returns the length of the circular buffer (a power of two) in samples. */
     int getBufferLength() noexcept{
         return bufferLength;
     }
     
     /** Places a new sample into the delay line, overwriting the previous oldest element. Does the same as JUCE’s pushSample. */
-    void write(float sample) noexcept;
+    void write(SampleType sample) noexcept;
+    
+    /** Reads a sample from the delay line, similar to JUCE’s popSample.
+        @param interpolator Interpolation policy (see Interpolation.h) used for the fractional part.
+        @param writeOffset  Number of samples that will be written before this read logically happens.
+                            Lets a block read all of its taps first & write afterwards, as long as
+                            writeOffset <= delayInSamples (the taps never reach into unwritten samples).
+     */
+    template<typename Interpolator>
+    SampleType read(Interpolator& interpolator, float delayInSamples, int writeOffset = 0) const noexcept;
+    
+    /** Reads a sample using linear interpolation. */
+    SampleType read(float delayInSamples, int writeOffset = 0) const noexcept{
+        Interpolation::Linear<SampleType> linear;
+        return read(linear, delayInSamples, writeOffset);
+    }
+    
+    /** Writes a block of samples, copying them into the buffer in (at most two) contiguous spans. */
+    void writeBlock(const SampleType* input, int numSamples) noexcept;
+    
+    /** Reads a block of samples for the block that the next writeBlock() call will write.
+        Sample i is read as if the first i + 1 samples of that block had already been written
+        (read() with a writeOffset of i + 1), so every delay must be at least numSamples.
+        @param delaysInSamples  One delay per output sample.
+     */
+    template<typename Interpolator>
+    void readBlock(Interpolator& interpolator, SampleType* output, const float* delaysInSamples, int numSamples) const noexcept;
     
-    /** Reads a sample from the delay line, similar to JUCE’s popSample. */
-    float read(float delayInSamples) const noexcept;
+    /** Same as readBlock(), but the left & right lane of a StereoSample each read at their own delay,
+        e.g. for modulation with a stereo phase offset. Both reads go through the same interpolator,
+        so it has to be one without state of its own (not the Allpass).
+     */
+    template<typename Interpolator>
+    void readBlock(Interpolator& interpolator, SampleType* output, const float* delaysL, const float* delaysR,
+                   int numSamples) const noexcept;
+    
+    /** Reads a block of samples using linear interpolation. */
+    void readBlock(SampleType* output, const float* delaysInSamples, int numSamples) const noexcept{
+        Interpolation::Linear<SampleType> linear;
+        readBlock(linear, output, delaysInSamples, numSamples);
+    }
+    
+    /** Fades the newest numSamples samples out to silence, in place. The newest one ends up at 0.
+        Used when writing starts again after a pause, so the old & new samples don't meet with a jump.
+     */
+    void fadeOut(int numSamples) noexcept;
+    
+    /** Copies numSamples samples, for the block that the next writeBlock() call will write (like readBlock()).
+        Sample i is the one delayInSamples - i - 1 samples back, so the whole block is a contiguous span of
+        the buffer (two if it crosses the end of a page). No interpolation, no per-sample index math.
+     */
+    void readSpan(SampleType* output, int delayInSamples, int numSamples) const noexcept;
+    
+    /** Same as readSpan(), but backwards: sample 0 is delayInSamples back & every next sample is one older,
+        so the buffer plays in reverse. Still one contiguous span per page, read from the top down.
+     */
+    void readReverse(SampleType* output, int delayInSamples, int numSamples) const noexcept;
+    
+    /** Adds numTaps taps to a block, for the block that the next writeBlock() call will write (like readBlock()).
+        Tap k reads delaysInSamples[k] samples back, a whole number, so no interpolation is needed. Its gain
+        goes in a straight line from startGains[k] to endGains[k] over the block.
+        The delays don't move during the block, so every tap is a contiguous span of the buffer (two if it
+        crosses the end of a page).
+     */
+    void addTaps(SampleType* output, const int* delaysInSamples, const SampleType* startGains,
+                 const SampleType* endGains, int numTaps, int numSamples) const noexcept;
     
 private:
-    std::unique_ptr<float[]> buffer; // Holds the memory region that will store the delayed samples
+    // Exact storage keeps the samples as they are, the compact formats pack every float lane into a Word
+    static_assert(sizeof(SampleType) % sizeof(float) == 0);
+    static constexpr int wordsPerSample = Storage::isExact ? 1 : int(sizeof(SampleType) / sizeof(float));
+    using Cell = std::conditional_t<Storage::isExact, SampleType, typename Storage::Word>;
+    
+    /** Returns the index of the oldest sample an interpolator of this type reads. */
+    template<typename Interpolator>
+    int oldestPoint(float delayInSamples, int writeOffset) const noexcept{
+        int integerDelay = int(delayInSamples); // Strips out fractional component
+        jassert(integerDelay - writeOffset >= Interpolator::newerPoints - 1);      // no unwritten samples
+        jassert(integerDelay + Interpolator::olderPoints <= bufferLength - 1);      // not beyond oldest sample
+        
+        // The oldest point comes first in memory, the guard region holds any points past the end of its page
+        return (writeIndex + writeOffset - integerDelay - Interpolator::olderPoints) & mask;
+    }
+    
+    /** Where sample index is stored. The guardLength samples after it are in the same page. */
+    const Cell* cell(int index) const noexcept{
+        return pageTable[size_t(index >> pageShift)] + (index & pageMask) * wordsPerSample;
+    }
+    
+    /** Interpolates between the points that start at oldestIndex. */
+    template<typename Interpolator>
+    SampleType interpolate(Interpolator& interpolator, int oldestIndex, float fraction) const noexcept{
+        if constexpr (Storage::isExact)
+            return interpolator.interpolate(cell(oldestIndex) + Interpolator::olderPoints, fraction);
+        else{
+            // Unpack just the points this read needs
+            constexpr int numPoints = Interpolator::olderPoints + Interpolator::newerPoints;
+            SampleType points[numPoints];
+            Storage::unpack(cell(oldestIndex), reinterpret_cast<float*>(points), numPoints * wordsPerSample);
+            return interpolator.interpolate(points + Interpolator::olderPoints, fraction);
+        }
+    }
+    
+    /** Stores numSamples samples, starting at index. They may not run past the end of its page. */
+    void store(const SampleType* input, int index, int numSamples) noexcept;
+    
+    /** Takes a page from the pool for the samples of page, if it doesn't have one yet. */
+    void commit(int page) noexcept;
+    void takePage(int page) noexcept;
+    
+    /** Mirrors the first guardLength samples of page into the guard region of the page before it. */
+    void updateGuard(int page) noexcept;
+    
+    // Number of samples mirrored past the end of each page. Reads may use this many points above their index.
+    static constexpr int guardLength = 4;
+    
+    // Longest page in samples, shorter buffers are a single page
+    static constexpr int maxPageShift = 14;
+    
+    juce::HeapBlock<Cell> pool;          // memory for every page, untouched until a page is committed
+    juce::HeapBlock<Cell> silence;       // the page every uncommitted page points to, always zero
+    std::vector<Cell*> pageTable;        // one entry per page of the buffer
+    std::vector<Cell*> freePages;        // pages of the pool that aren't committed, never reallocates
+    Storage storage;
+    
     int bufferLength = 0;
+    int mask = 0;       // bufferLength - 1, wraps an index around the buffer
     int writeIndex = 0; // where the most recent value was written
+    
+    int pageShift = 0;  // log2 of the page length
+    int pageMask = 0;   // page length - 1
+    int pageStride = 0; // cells per page, guard region included
+    int oldestPage = 0; // the committed pages run from oldestPage up to the page of writeIndex
+    int numCommitted = 0;
 };
+
+//==============================================================================
+template<typename SampleType, typename Storage>
+template<typename Interpolator>
+SampleType DelayLine<SampleType, Storage>::read(Interpolator& interpolator, float delayInSamples, int writeOffset) const noexcept{
+    static_assert(Interpolator::olderPoints + Interpolator::newerPoints <= guardLength + 1);
+    jassert(delayInSamples >= 0.0f);
+    
+    int oldestIndex = oldestPoint<Interpolator>(delayInSamples, writeOffset);
+    float fraction = delayInSamples - float(int(delayInSamples));
+    return interpolate(interpolator, oldestIndex, fraction);
+}
+
+// Same as read(), with writeOffset = i + 1 for sample i. No branches, so the loop stays tight.
+template<typename SampleType, typename Storage>
+template<typename Interpolator>
+void DelayLine<SampleType, Storage>::readBlock(Interpolator& interpolator, SampleType* output, const float* delaysInSamples,
+                                               int numSamples) const noexcept{
+    static_assert(Interpolator::olderPoints + Interpolator::newerPoints <= guardLength + 1);
+    jassert(bufferLength > 0);
+    
+    for(int i = 0; i < numSamples; ++i){
+        float delayInSamples = delaysInSamples[i];
+        int oldestIndex = oldestPoint<Interpolator>(delayInSamples, i + 1);
+        float fraction = delayInSamples - float(int(delayInSamples));
+        output[i] = interpolate(interpolator, oldestIndex, fraction);
+    }
+}
+
+// Two reads per sample, one for each lane. Each one interpolates both lanes & keeps one of them,
+// which is still cheaper than splitting the interleaved samples apart.
+template<typename SampleType, typename Storage>
+template<typename Interpolator>
+void DelayLine<SampleType, Storage>::readBlock(Interpolator& interpolator, SampleType* output, const float* delaysL,
+                                               const float* delaysR, int numSamples) const noexcept{
+    static_assert(std::is_same_v<SampleType, StereoSample>);
+    static_assert(Interpolator::olderPoints + Interpolator::newerPoints <= guardLength + 1);
+    jassert(bufferLength > 0);
+    
+    for(int i = 0; i < numSamples; ++i){
+        float delayL = delaysL[i];
+        float delayR = delaysR[i];
+        int oldestL = oldestPoint<Interpolator>(delayL, i + 1);
+        int oldestR = oldestPoint<Interpolator>(delayR, i + 1);
+        output[i].left  = interpolate(interpolator, oldestL, delayL - float(int(delayL))).left;
+        output[i].right = interpolate(interpolator, oldestR, delayR - float(int(delayR))).right;
+    }
+}
@@ -0,0 +1,193 @@
+/*
+  ==============================================================================
+
+    DelayStorage.h
+    Storage formats for the samples inside a DelayLine. The compact ones store a float in 16 bits,
+    which halves the memory & bandwidth of a long delay line:
+        Float       32-bit float, exact. The default.
+        Half        IEEE half float, the error stays about 70 dB below the signal at any level.
+        Dithered16  16-bit integer with TPDF dither & 12 dB of headroom. Noise floor about 81 dB
+                    below a full scale sine, clips above +12 dBFS.
+    Feedback stores the signal again on every repeat: at feedback f the dither noise grows by
+    1 / (1 - f * f), the error of half floats on a steady tone by up to 1 / (1 - f).
+
+    Every format has the same interface, DelayLine is a template on it:
+        Word                        what one float is stored as
+        isExact                     Words are the samples themselves, no packing needed
+        pack(input, output, n)      floats -> Words
+        unpack(input, output, n)    Words -> floats
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <bit>
+#include <cstdint>
+
+#if defined(__F16C__)
+ #include <immintrin.h>
+ #define DELAY_STORAGE_F16C 1
+#elif defined(__aarch64__)
+ #include <arm_neon.h>
+ #define DELAY_STORAGE_NEON 1
+#endif
+
+namespace DelayStorage
+{
+    /** Order of the choices of the DELAY_STORAGE build flag */
+    enum Type { full, half, dithered16 };
+
+    /** Plain 32-bit floats */
+    struct Float
+    {
+        using Word = float;
+        static constexpr bool isExact = true;
+
+        void reset() noexcept {}
+        void pack(const float* input, Word* output, int numSamples) noexcept
+        {
+            std::copy(input, input + numSamples, output);
+        }
+        static void unpack(const Word* input, float* output, int numSamples) noexcept
+        {
+            std::copy(input, input + numSamples, output);
+        }
+    };
+
+    /** IEEE 754 half floats, rounded to nearest even */
+    struct Half
+    {
+        using Word = std::uint16_t;
+        static constexpr bool isExact = false;
+
+        // Branch-light conversions, for CPUs without hardware support & for the last few samples of a block
+        static Word fromFloat(float value) noexcept
+        {
+            std::uint32_t x = std::bit_cast<std::uint32_t>(value);
+            std::uint32_t sign = x & 0x80000000u;
+            x ^= sign;
+            std::uint32_t result;
+            if(x >= 0x47800000u)                   // too large for a half: infinity, or NaN stays NaN
+                result = x > 0x7f800000u ? 0x7e00u : 0x7c00u;
+            else if(x < 0x38800000u)               // subnormal half: let a float addition do the rounding
+                result = std::bit_cast<std::uint32_t>(std::bit_cast<float>(x) + 0.5f) - 0x3f000000u;
+            else{
+                std::uint32_t odd = (x >> 13) & 1u;
+                result = (x + 0xc8000fffu + odd) >> 13;  // rebias the exponent & round to nearest even
+            }
+            return Word((sign >> 16) | result);
+        }
+
+        static float toFloat(Word half) noexcept
+        {
+            constexpr std::uint32_t exponentMask = 0x7c00u << 13;
+            std::uint32_t x = std::uint32_t(half & 0x7fffu) << 13;
+            std::uint32_t exponent = x & exponentMask;
+            x += (127 - 15) << 23;                 // rebias the exponent
+            if(exponent == exponentMask)           // infinity or NaN
+                x += (128 - 16) << 23;
+            else if(exponent == 0)                 // subnormal half, renormalise
+                x = std::bit_cast<std::uint32_t>(std::bit_cast<float>(x + (1u << 23)) - std::bit_cast<float>(113u << 23));
+            return std::bit_cast<float>(x | (std::uint32_t(half & 0x8000u) << 16));
+        }
+
+        void reset() noexcept {}
+
+        void pack(const float* input, Word* output, int numSamples) noexcept
+        {
+            int i = 0;
+           #if DELAY_STORAGE_F16C
+            for(; i + 8 <= numSamples; i += 8){
+                __m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(input + i), _MM_FROUND_TO_NEAREST_INT);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), packed);
+            }
+           #elif DELAY_STORAGE_NEON
+            for(; i + 4 <= numSamples; i += 4)
+                vst1_u16(output + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(input + i))));
+           #endif
+            for(; i < numSamples; ++i)
+                output[i] = fromFloat(input[i]);
+        }
+
+        static void unpack(const Word* input, float* output, int numSamples) noexcept
+        {
+            int i = 0;
+           #if DELAY_STORAGE_F16C
+            for(; i + 8 <= numSamples; i += 8){
+                __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+                _mm256_storeu_ps(output + i, _mm256_cvtph_ps(packed));
+            }
+           #elif DELAY_STORAGE_NEON
+            for(; i + 4 <= numSamples; i += 4)
+                vst1q_f32(output + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(input + i))));
+           #endif
+            for(; i < numSamples; ++i)
+                output[i] = toFloat(input[i]);
+        }
+    };
+
+    /** 16-bit integers with triangular (TPDF) dither, so the rounding error is noise instead of distortion */
+    struct Dithered16
+    {
+        using Word = std::int16_t;
+        static constexpr bool isExact = false;
+
+        static constexpr float headroom = 4.0f;  // +12 dB above full scale before the samples clip
+        static constexpr float scale = 32767.0f / headroom;
+
+        void reset() noexcept
+        {
+            lcg = lcgSeed;
+            xorshift = xorshiftSeed;
+        }
+
+        void pack(const float* input, Word* output, int numSamples) noexcept
+        {
+            for(int i = 0; i < numSamples; ++i){
+                float x = input[i] * scale + nextDither();
+                x = std::clamp(x, -32767.0f, 32767.0f);
+                output[i] = Word(x + (x < 0.0f ? -0.5f : 0.5f));  // round to nearest
+            }
+        }
+
+        static void unpack(const Word* input, float* output, int numSamples) noexcept
+        {
+            for(int i = 0; i < numSamples; ++i)
+                output[i] = float(input[i]) * (1.0f / scale);
+        }
+
+    private:
+        static constexpr std::uint32_t lcgSeed = 1;
+        static constexpr std::uint32_t xorshiftSeed = 0x2545f491;
+
+        /** TPDF noise of +-1 LSB: the difference of two uniform values from two generators, which only
+            repeat together after about 2^64 samples, so no delay time lines up with the pattern */
+        float nextDither() noexcept
+        {
+            lcg = lcg * 1664525u + 1013904223u;
+            xorshift ^= xorshift << 13;
+            xorshift ^= xorshift >> 17;
+            xorshift ^= xorshift << 5;
+            return float(int(lcg >> 8) - int(xorshift >> 8)) * (1.0f / 16777216.0f);  // top 24 bits of each
+        }
+
+        std::uint32_t lcg = lcgSeed;
+        std::uint32_t xorshift = xorshiftSeed;
+    };
+
+    /*  Build flag that picks the storage of the plug-in's delay line (see Type), e.g. DELAY_STORAGE=1
+        in the Projucer's preprocessor definitions for half floats. */
+   #ifndef DELAY_STORAGE
+    #define DELAY_STORAGE 0
+   #endif
+
+   #if DELAY_STORAGE == 1
+    using Default = Half;
+   #elif DELAY_STORAGE == 2
+    using Default = Dithered16;
+   #else
+    using Default = Float;
+   #endif
+}
@@ -0,0 +1,103 @@
+/*
+  ==============================================================================
+
+    Diffuser.cpp
+
+  ==============================================================================
+*/
+
+#include "Diffuser.h"
+#include <algorithm>
+#include <iterator>
+
+/*
+    Delay of every allpass in ms. Each step is about twice as long as the one before, & no two
+    lengths share a common factor, so the echoes of the different lines don't pile up on each other.
+ */
+static constexpr float delayTimes[3][4] = {
+    {  2.3f,  3.1f,  4.3f,  5.9f },
+    {  6.7f,  8.9f, 10.7f, 13.1f },
+    { 14.9f, 18.7f, 22.3f, 27.1f },
+};
+
+void Diffuser::prepare(double sampleRate)
+{
+    static_assert(std::size(delayTimes) == numSteps);
+
+    for(int s = 0; s < numSteps; ++s){
+        Step& step = steps[size_t(s)];
+        int longest = 0;
+        for(int k = 0; k < 4; ++k){
+            step.delays[size_t(k)] = std::max(1, int(delayTimes[s][k] / 1000.0 * sampleRate));
+            longest = std::max(longest, step.delays[size_t(k)]);
+        }
+        int length = juce::nextPowerOfTwo(longest + 1);
+        step.buffer.resize(size_t(length));
+        step.mask = length - 1;
+    }
+    reset();
+}
+
+double Diffuser::getLongestPathSeconds() noexcept
+{
+    double seconds = 0.0;
+    for(auto& stepTimes : delayTimes)
+        seconds += *std::max_element(std::begin(stepTimes), std::end(stepTimes)) / 1000.0;
+    return seconds;
+}
+
+// The signal left in an allpass gets allpassGain quieter every time it goes around its delay
+double Diffuser::getTailSeconds(float threshold) noexcept
+{
+    double trips = std::log(double(threshold)) / std::log(double(allpassGain));
+    return std::ceil(trips) * getLongestPathSeconds();
+}
+
+void Diffuser::reset() noexcept
+{
+    for(auto& step : steps){
+        std::fill(step.buffer.begin(), step.buffer.end(), Quad());
+        step.writeIndex = 0;
+    }
+}
+
+// One sample through every step. The allpass arithmetic & the matrix work on all 4 lines at once,
+// only picking the delayed samples out of the buffers is done line by line.
+Diffuser::Quad Diffuser::tick(Quad x) noexcept
+{
+    for(auto& step : steps){
+        // Built in one go rather than lane by lane, so it goes straight into a register instead of via the stack
+        const Quad* buffer = step.buffer.data();
+        auto read = [&](int k) noexcept { return buffer[(step.writeIndex - step.delays[size_t(k)]) & step.mask].v[k]; };
+        Quad delayed{ { read(0), read(1), read(2), read(3) } };
+
+        Quad input = x + delayed * allpassGain;
+        step.buffer[size_t(step.writeIndex)] = input;
+        step.writeIndex = (step.writeIndex + 1) & step.mask;
+
+        x = (delayed - input * allpassGain).hadamard();
+    }
+    return x;
+}
+
+void Diffuser::process(StereoSample* samples, const Parameters::Ramp& amount, int numSamples) noexcept
+{
+    // Switched off for the whole chunk: the state is cleared, so it starts from silence once the knob moves again
+    bool useDiffuser = !(amount.isConstant && amount.value == 0.0f);
+    if(active && !useDiffuser)
+        reset();
+    active = useDiffuser;
+    if(!useDiffuser)
+        return;
+
+    // Stereo to 4 lines & back again. Both are scaled so that without diffusion the signal comes out as it went in.
+    constexpr float scale = 0.7071067811865476f;  // 1 / sqrt(2)
+    for(int i = 0; i < numSamples; ++i){
+        StereoSample x = samples[i];
+        Quad lines = tick(Quad{ { x.left, x.right, x.left, x.right } } * scale);
+        StereoSample diffused{ (lines.v[0] + lines.v[2]) * scale, (lines.v[1] + lines.v[3]) * scale };
+
+        float mix = amount.isConstant ? amount.value : amount.values[i];
+        samples[i] = x + (diffused - x) * mix;
+    }
+}
@@ -0,0 +1,78 @@
+/*
+  ==============================================================================
+
+    Diffuser.h
+
+    Diffusion in the feedback path, for smeared, ambient repeats.
+    The stereo feedback is spread over 4 lines that go through a few steps of an allpass per line
+    & a 4x4 Hadamard mix, then folded back to stereo. Neither changes the energy, so the diffuser
+    can't make the feedback loop unstable. The 4 lines sit side by side in a Quad, like StereoSample.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <array>
+#include <vector>
+#include "Parameters.h"
+#include "StereoSample.h"
+
+class Diffuser
+{
+public:
+    /** Sets the delay lengths for the sample rate. Allocates, so don't call from the audio thread. */
+    void prepare(double sampleRate);
+
+    /** Clears the delays, e.g. when playback restarts */
+    void reset() noexcept;
+
+    /**
+        Diffuses the feedback in place. amount is the Diffusion parameter, 0 - 1: how much of the
+        diffused signal replaces the feedback. At 0 for a whole chunk this does nothing at all.
+     */
+    void process(StereoSample* samples, const Parameters::Ramp& amount, int numSamples) noexcept;
+
+    /** Longest way through the steps in seconds, the most a trip through the diffuser delays anything */
+    static double getLongestPathSeconds() noexcept;
+
+    /** How long the diffuser rings after its input stops, until it's below threshold (linear gain) */
+    static double getTailSeconds(float threshold) noexcept;
+
+private:
+    /** One sample of the 4 lines */
+    struct alignas(16) Quad
+    {
+        float v[4] = {};
+
+        Quad operator+(Quad other) const noexcept { Quad r; for(int k = 0; k < 4; ++k) r.v[k] = v[k] + other.v[k]; return r; }
+        Quad operator-(Quad other) const noexcept { Quad r; for(int k = 0; k < 4; ++k) r.v[k] = v[k] - other.v[k]; return r; }
+        Quad operator*(float gain) const noexcept { Quad r; for(int k = 0; k < 4; ++k) r.v[k] = v[k] * gain; return r; }
+
+        /** Orthogonal 4x4 Hadamard matrix (scaled by 1/2): every line ends up in every other one */
+        Quad hadamard() const noexcept
+        {
+            float a = v[0] + v[1], b = v[0] - v[1];
+            float c = v[2] + v[3], d = v[2] - v[3];
+            return Quad{ { a + c, b + d, a - c, b - d } } * 0.5f;
+        }
+    };
+
+    /** The allpasses of one step, one per line */
+    struct Step
+    {
+        std::vector<Quad> buffer;     // power of two long, the lines are interleaved like StereoSample
+        std::array<int, 4> delays{};  // in samples
+        int mask = 0;
+        int writeIndex = 0;
+    };
+
+    Quad tick(Quad x) noexcept;
+
+    static constexpr int numSteps = 3;
+    static constexpr float allpassGain = 0.6f;
+
+    std::array<Step, numSteps> steps;
+    bool active = false;
+};
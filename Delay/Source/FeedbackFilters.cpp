@@ -0,0 +1,141 @@
+/*
+  ==============================================================================
+
+    FeedbackFilters.cpp
+
+  ==============================================================================
+*/
+
+#include "FeedbackFilters.h"
+
+void FeedbackFilters::prepare(double sampleRate)
+{
+    /* The table is spaced evenly in octaves from 20 Hz to 20 kHz, since that's also how the
+       cutoff knobs move. Frequencies near Nyquist are clamped so tan() stays finite. */
+    if(sampleRate != tableSampleRate){  // hosts prepare again all the time, mostly at the same rate
+        double octaves = std::log2(double(maxFrequency) / double(minFrequency));
+        int tableSize = int(std::ceil(octaves * pointsPerOctave)) + 2;
+        table.resize(size_t(tableSize));
+
+        for(int i = 0; i < tableSize; ++i){
+            double frequency = double(minFrequency) * std::exp2(double(i) / pointsPerOctave);
+            frequency = std::min(frequency, 0.49 * sampleRate);
+            table[size_t(i)] = float(std::tan(juce::MathConstants<double>::pi * frequency / sampleRate));
+        }
+        tableSampleRate = sampleRate;
+    }
+
+    lowCutFilter.cutoff = -1.0f;
+    highCutFilter.cutoff = -1.0f;
+    reset();
+}
+
+void FeedbackFilters::reset() noexcept
+{
+    lowCutFilter.reset();
+    highCutFilter.reset();
+    samplesUntilUpdate = 0;
+}
+
+void FeedbackFilters::setControlInterval(int numSamples) noexcept
+{
+    jassert(numSamples > 0);
+    controlInterval = std::max(1, numSamples);
+    samplesUntilUpdate = std::min(samplesUntilUpdate, controlInterval);
+}
+
+float FeedbackFilters::warpedFrequency(float cutoff) const noexcept
+{
+    jassert(!table.empty());  // forgot to call prepare()?
+
+    float position = std::log2(cutoff / minFrequency) * float(pointsPerOctave);
+    position = std::clamp(position, 0.0f, float(table.size() - 2));
+    int index = int(position);
+    float fraction = position - float(index);
+    return table[size_t(index)] + fraction * (table[size_t(index) + 1] - table[size_t(index)]);
+}
+
+void FeedbackFilters::updateCutoff(Filter& filter, float cutoff) noexcept
+{
+    // Only update/modify filter if Cut freq changed from last time
+    if(cutoff != filter.cutoff){
+        filter.setCoefficients(warpedFrequency(cutoff));
+        filter.cutoff = cutoff;
+    }
+}
+
+void FeedbackFilters::process(StereoSample* samples, const Parameters::Ramp& lowCut,
+                              const Parameters::Ramp& highCut, int numSamples) noexcept
+{
+    /* A filter that sits at its neutral extreme for the whole chunk is switched off. Its state is cleared,
+       so it starts from silence once the knob moves again, instead of from whatever it held back then. */
+    bool useLowCut  = !(lowCut.isConstant && lowCut.value <= minFrequency);
+    bool useHighCut = !(highCut.isConstant && highCut.value >= maxFrequency);
+
+    if(lowCutFilter.active && !useLowCut)
+        lowCutFilter.reset();
+    if(highCutFilter.active && !useHighCut)
+        highCutFilter.reset();
+    lowCutFilter.active = useLowCut;
+    highCutFilter.active = useHighCut;
+
+    if(!useLowCut && !useHighCut)
+        return;
+
+    int i = 0;
+    while(i < numSamples){
+        // Control rate: pick up the cutoffs at the start of every interval
+        if(samplesUntilUpdate == 0){
+            if(useLowCut)
+                updateCutoff(lowCutFilter, lowCut.isConstant ? lowCut.value : lowCut.values[i]);
+            if(useHighCut)
+                updateCutoff(highCutFilter, highCut.isConstant ? highCut.value : highCut.values[i]);
+            samplesUntilUpdate = controlInterval;
+        }
+
+        int spanSize = std::min(samplesUntilUpdate, numSamples - i);
+        if(useLowCut && useHighCut)
+            processSpan<true, true>(samples + i, spanSize);
+        else if(useLowCut)
+            processSpan<true, false>(samples + i, spanSize);
+        else
+            processSpan<false, true>(samples + i, spanSize);
+
+        i += spanSize;
+        samplesUntilUpdate -= spanSize;
+    }
+}
+
+template<bool useLowCut, bool useHighCut>
+void FeedbackFilters::processSpan(StereoSample* samples, int numSamples) noexcept
+{
+    // Copies of the coefficients & state in locals, so the compiler can keep them in registers
+    Filter lo = lowCutFilter;
+    Filter hi = highCutFilter;
+
+    // One step of the TPT SVF for both lanes, see juce::dsp::StateVariableTPTFilter::processSample
+    auto tick = [](Filter& f, StereoSample x, StereoSample& lowpass, StereoSample& highpass){
+        highpass = (x - f.s1 * (f.g + Filter::R2) - f.s2) * f.h;
+        StereoSample bandpass = highpass * f.g + f.s1;
+        f.s1 = highpass * f.g + bandpass;
+        lowpass = bandpass * f.g + f.s2;
+        f.s2 = bandpass * f.g + lowpass;
+    };
+
+    for(int i = 0; i < numSamples; ++i){
+        StereoSample x = samples[i];
+        StereoSample lp, hp;
+        if constexpr (useLowCut){
+            tick(lo, x, lp, hp);
+            x = hp;
+        }
+        if constexpr (useHighCut){
+            tick(hi, x, lp, hp);
+            x = lp;
+        }
+        samples[i] = x;
+    }
+
+    lowCutFilter = lo;
+    highCutFilter = hi;
+}
@@ -0,0 +1,59 @@
+/*
+  ==============================================================================
+
+    LFO.h
+
+    Low-frequency oscillator that modulates the delay time: chorus, vibrato & flanging.
+    Reads a wavetable a whole chunk at a time.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <array>
+
+class LFO
+{
+public:
+    /** Order of the choices of the Mod Shape parameter */
+    enum Shape { sine, triangle };
+
+    void prepare(double sampleRate) noexcept;
+
+    /** Starts the next cycle from the beginning, e.g. when playback restarts */
+    void reset() noexcept;
+
+    /**
+        Fills one value per sample for each lane, between 0 & 1 (a unipolar LFO, so a modulated
+        delay only ever gets longer than the delay time). The right lane runs phaseOffset
+        (a fraction of a cycle) ahead of the left one.
+     */
+    void process(float* left, float* right, float frequency, Shape shape, float phaseOffset, int numSamples) noexcept;
+
+    /** Moves the start of the phase ramp up to the current sample, called on the control grid */
+    void sync() noexcept;
+
+private:
+    static constexpr int tableSize = 1024;  // power of two, one cycle
+    using Table = std::array<float, tableSize + 1>;  // the extra point is the first one again
+
+    /** One cycle of the shape, the same table for every instance */
+    static const Table& table(Shape shape) noexcept;
+
+    /** Looks phase (any number of cycles) up in the table, with linear interpolation */
+    static float lookup(const float* values, float phase) noexcept
+    {
+        phase -= std::floor(phase);
+        float position = phase * float(tableSize);
+        int index = int(position);
+        float fraction = position - float(index);
+        return values[index] + fraction * (values[index + 1] - values[index]);
+    }
+
+    float inverseSampleRate = 0.0f;
+    float increment = 0.0f;
+    float phase = 0.0f;  // 0 - 1, at the last sync()
+    int count = 0;       // samples since then, so the phase doesn't depend on how the chunks are cut
+};
@@ -62,6 +62,49 @@ static juce::String stringFromPercent(float value, int){
     return juce::String(int(value)) + " %";
 }
 
+static juce::String stringFromRate(float value, int){
+    return juce::String(value, 2) + " Hz";
+}
+
+static juce::String stringFromDegrees(float value, int){
+    return juce::String(int(value)) + " deg";
+}
+
+/* Steps a smoother over a block & writes its values. Unless the ramp ends inside the block,
+   it's a straight line from the current value to the one at the end of the block. */
+static void fillLinear(juce::LinearSmoothedValue<float>& smoother, float* values, int numSamples) noexcept
+{
+    auto end = smoother;
+    end.skip(numSamples);
+    if(end.isSmoothing()){
+        float start = smoother.getCurrentValue();
+        float step = (end.getCurrentValue() - start) / float(numSamples);
+        for(int i = 0; i < numSamples; ++i)
+            values[i] = start + step * float(i + 1);
+        smoother = end;
+    }
+    else{  // The ramp ends in this block, once per parameter change
+        for(int i = 0; i < numSamples; ++i)
+            values[i] = smoother.getNextValue();
+    }
+}
+
+// Steps a smoother over a block. Only writes values if the smoother is actually moving.
+static void fillRamp(juce::LinearSmoothedValue<float>& smoother, Parameters::Ramp& ramp,
+                     float* values, int numSamples) noexcept
+{
+    if(smoother.isSmoothing()){
+        fillLinear(smoother, values, numSamples);
+        ramp.values = values;
+        ramp.value = values[numSamples - 1];
+        ramp.isConstant = false;
+    }
+    else{
+        ramp.value = smoother.getTargetValue();
+        ramp.isConstant = true;
+    }
+}
+
 //==============================================================================
 /* Constructor
  * Caches locations of all paramters from APVTS
@@ -77,9 +120,64 @@ Parameters::Parameters(juce::AudioProcessorValueTreeState& apvts)
     castParameter(apvts, stereoParamID, stereoParam);
     castParameter(apvts, lowCutParamID, lowCutParam);
     castParameter(apvts, highCutParamID, highCutParam);
+    castParameter(apvts, diffusionParamID, diffusionParam);
+    castParameter(apvts, driveParamID, driveParam);
     castParameter(apvts, tempoSyncParamID, tempoSyncParam);
     castParameter(apvts, delayNoteParamID, delayNoteParam);
     castParameter(apvts, bypassParamID, bypassParam);
+    castParameter(apvts, qualityParamID, qualityParam);
+    castParameter(apvts, bypassModeParamID, bypassModeParam);
+    castParameter(apvts, freezeParamID, freezeParam);
+    castParameter(apvts, reverseParamID, reverseParam);
+    castParameter(apvts, timeChangeParamID, timeChangeParam);
+    castParameter(apvts, tapCountParamID, tapCountParam);
+    castParameter(apvts, swingParamID, swingParam);
+    for(int tap = 0; tap < maxTaps; ++tap){
+        castParameter(apvts, tapParamID(tap, "Time"), tapTimeParams[size_t(tap)]);
+        castParameter(apvts, tapParamID(tap, "Note"), tapNoteParams[size_t(tap)]);
+        castParameter(apvts, tapParamID(tap, "Level"), tapLevelParams[size_t(tap)]);
+        castParameter(apvts, tapParamID(tap, "Pan"), tapPanParams[size_t(tap)]);
+    }
+    castParameter(apvts, modRateParamID, modRateParam);
+    castParameter(apvts, modDepthParamID, modDepthParam);
+    castParameter(apvts, modShapeParamID, modShapeParam);
+    castParameter(apvts, modPhaseParamID, modPhaseParam);
+    castParameter(apvts, modSyncParamID, modSyncParam);
+    castParameter(apvts, modNoteParamID, modNoteParam);
+    
+    // Every change bumps the version, so update() knows when to read the parameters again
+    for(auto* param : allParameters())
+        param->addListener(this);
+}
+
+Parameters::~Parameters()
+{
+    for(auto* param : allParameters())
+        param->removeListener(this);
+}
+
+std::array<juce::AudioProcessorParameter*, Parameters::numParameters> Parameters::allParameters() const noexcept
+{
+    std::array<juce::AudioProcessorParameter*, numParameters> params{
+        gainParam, delayTimeParam, mixParam, feedbackParam, stereoParam, lowCutParam, highCutParam,
+        tempoSyncParam, bypassParam, delayNoteParam, qualityParam, bypassModeParam, timeChangeParam,
+        tapCountParam, swingParam, modRateParam, modDepthParam, modShapeParam, modPhaseParam, modSyncParam,
+        modNoteParam, diffusionParam, driveParam, freezeParam, reverseParam };
+    
+    auto next = params.begin() + 25;
+    for(int tap = 0; tap < maxTaps; ++tap){
+        *next++ = tapTimeParams[size_t(tap)];
+        *next++ = tapNoteParams[size_t(tap)];
+        *next++ = tapLevelParams[size_t(tap)];
+        *next++ = tapPanParams[size_t(tap)];
+    }
+    jassert(next == params.end());
+    return params;
+}
+
+void Parameters::parameterValueChanged(int, float)
+{
+    version.fetch_add(1, std::memory_order_release);
 }
 
 //==============================================================================
@@ -104,10 +202,16 @@ juce::AudioProcessorValueTreeState::ParameterLayout Parameters::createParameterL
                     juce::AudioParameterFloatAttributes().withStringFromValueFunction(stringFromPercent)
                     // Tells JUCE to use the string-from-value function when host asks for a textual representation of the parameters value
                     ));
+    
+    // Delay times up to a minute, skewed so the first 5 seconds still take up most of the knob.
+    // This changed the normalized mapping of the old 5..5000 ms range (skew 0.25): saved states keep
+    // their times, automation recorded before maps to different ones (see stateVersion)
+    juce::NormalisableRange<float> delayTimeRange{minDelayTime, maxDelayTime, 0.001f};
+    delayTimeRange.setSkewForCentre(320.0f);
     layout.add(std::make_unique<juce::AudioParameterFloat>(
                     delayTimeID,
                     "DelayTime",
-                    juce::NormalisableRange<float> {minDelayTime, maxDelayTime, 0.001f, 0.25f},
+                    delayTimeRange,
                     100.0f,
                     juce::AudioParameterFloatAttributes()
                         .withStringFromValueFunction(stringFromMilliseconds)
@@ -148,6 +252,22 @@ juce::AudioProcessorValueTreeState::ParameterLayout Parameters::createParameterL
                            .withStringFromValueFunction(stringFromHz)
                            .withValueFromStringFunction(hzFromString)
                     ));
+    // Allpass diffuser in the feedback path, smears the repeats out a little more on every trip
+    layout.add(std::make_unique<juce::AudioParameterFloat>(
+                    diffusionParamID,
+                    "Diffusion",
+                    juce::NormalisableRange<float> {0.0f, 100.0f, 1.0f},
+                    0.0f,
+                    juce::AudioParameterFloatAttributes().withStringFromValueFunction(stringFromPercent)
+                    ));
+    // Soft saturation in the feedback path, 0% keeps the feedback clean
+    layout.add(std::make_unique<juce::AudioParameterFloat>(
+                    driveParamID,
+                    "Drive",
+                    juce::NormalisableRange<float> {0.0f, 100.0f, 1.0f},
+                    0.0f,
+                    juce::AudioParameterFloatAttributes().withStringFromValueFunction(stringFromPercent)
+                    ));
     layout.add(std::make_unique<juce::AudioParameterBool>(tempoSyncParamID,"Tympo Sync",false));
     layout.add(std::make_unique<juce::AudioParameterBool>(bypassParamID, "Bypass", false));
     
@@ -157,11 +277,111 @@ juce::AudioProcessorValueTreeState::ParameterLayout Parameters::createParameterL
     
     layout.add(std::make_unique<juce::AudioParameterChoice>(delayNoteParamID, "Delay Note", noteLengths, 9));
     
+    // Interpolation used for fractional delays, in the order of Interpolation::Type
+    juce::StringArray qualities{"Nearest", "Linear", "Hermite", "Lagrange", "Allpass"};
+    layout.add(std::make_unique<juce::AudioParameterChoice>(qualityParamID, "Quality", qualities, 1));
+    
+    // What bypass does with the echoes: keep them for when the delay comes back, or throw them away
+    juce::StringArray bypassModes{"Freeze", "Flush"};
+    layout.add(std::make_unique<juce::AudioParameterChoice>(bypassModeParamID, "Bypass Mode", bypassModes, 0));
+    
+    // Looper: the delay line stops recording & plays what it holds over & over
+    layout.add(std::make_unique<juce::AudioParameterBool>(freezeParamID, "Freeze", false));
+    
+    // Reverse delay: every grain of one delay time is played backwards
+    layout.add(std::make_unique<juce::AudioParameterBool>(reverseParamID, "Reverse", false));
+    
+    // How the delay gets to a new delay time, in the order of Parameters::TimeChange:
+    // mute the echoes while the delay jumps, crossfade from the old delay time to the new one,
+    // or glide to it like the tape speed of a tape delay, which bends the pitch of the echoes
+    juce::StringArray timeChanges{"Duck", "Crossfade", "Tape"};
+    layout.add(std::make_unique<juce::AudioParameterChoice>(timeChangeParamID, "Time Change", timeChanges, 0));
+    
+    /*          Multi-tap
+      Extra taps on top of the delay, each one with its own time, level & pan. They play what's in the
+      delay line (repeats included) but don't feed back. Tempo Sync switches them to note lengths too.
+      Swing moves taps 1, 3, 5 & 7 later, at 100% by a third of the distance to the tap before them
+      (a straight 1/8 pattern becomes a triplet shuffle).
+     */
+    layout.add(std::make_unique<juce::AudioParameterInt>(tapCountParamID, "Taps", 0, maxTaps, 0));
+    layout.add(std::make_unique<juce::AudioParameterFloat>(
+                    swingParamID,
+                    "Swing",
+                    juce::NormalisableRange<float> {0.0f, 100.0f, 1.0f},
+                    0.0f,
+                    juce::AudioParameterFloatAttributes().withStringFromValueFunction(stringFromPercent)
+                    ));
+    
+    // By default the taps count up in 1/16, 1/8, 1/8 dot, 1/4, ... at 120 BPM, each one a little quieter
+    const float defaultTapTimes[maxTaps] = { 125.0f, 250.0f, 375.0f, 500.0f, 750.0f, 1000.0f, 1500.0f, 2000.0f };
+    const int defaultTapNotes[maxTaps] = { 3, 6, 8, 9, 11, 12, 14, 15 };
+    for(int tap = 0; tap < maxTaps; ++tap){
+        juce::String name = "Tap " + juce::String(tap + 1);
+        layout.add(std::make_unique<juce::AudioParameterFloat>(
+                        tapParamID(tap, "Time"),
+                        name + " Time",
+                        delayTimeRange,
+                        defaultTapTimes[tap],
+                        juce::AudioParameterFloatAttributes()
+                            .withStringFromValueFunction(stringFromMilliseconds)
+                            .withValueFromStringFunction(millisecondsFromString)
+                        ));
+        layout.add(std::make_unique<juce::AudioParameterChoice>(tapParamID(tap, "Note"), name + " Note",
+                                                                noteLengths, defaultTapNotes[tap]));
+        layout.add(std::make_unique<juce::AudioParameterFloat>(
+                        tapParamID(tap, "Level"),
+                        name + " Level",
+                        juce::NormalisableRange<float> {0.0f, 100.0f, 1.0f},
+                        std::round(100.0f * std::pow(0.8f, float(tap))),
+                        juce::AudioParameterFloatAttributes().withStringFromValueFunction(stringFromPercent)
+                        ));
+        layout.add(std::make_unique<juce::AudioParameterFloat>(
+                        tapParamID(tap, "Pan"),
+                        name + " Pan",
+                        juce::NormalisableRange<float> {-100.0f, 100.0f, 1.0f},
+                        tap % 2 == 0 ? -50.0f : 50.0f,
+                        juce::AudioParameterFloatAttributes().withStringFromValueFunction(stringFromPercent)
+                        ));
+    }
+    
+    /*          Modulation
+      An LFO that moves the read position up to Mod Depth further back than the delay time.
+      A few ms of depth with a short delay & no feedback is a chorus (or vibrato at 100% mix),
+      add feedback for flanging. Mod Phase offsets the LFO of the right channel.
+     */
+    layout.add(std::make_unique<juce::AudioParameterFloat>(
+                    modRateParamID,
+                    "Mod Rate",
+                    juce::NormalisableRange<float> {0.05f, 10.0f, 0.01f, 0.4f},
+                    0.5f,
+                    juce::AudioParameterFloatAttributes().withStringFromValueFunction(stringFromRate)
+                    ));
+    layout.add(std::make_unique<juce::AudioParameterFloat>(
+                    modDepthParamID,
+                    "Mod Depth",
+                    juce::NormalisableRange<float> {0.0f, maxModDepth, 0.01f},
+                    0.0f,
+                    juce::AudioParameterFloatAttributes()
+                        .withStringFromValueFunction(stringFromMilliseconds)
+                        .withValueFromStringFunction(millisecondsFromString)
+                    ));
+    juce::StringArray shapes{"Sine", "Triangle"};  // in the order of LFO::Shape
+    layout.add(std::make_unique<juce::AudioParameterChoice>(modShapeParamID, "Mod Shape", shapes, 0));
+    layout.add(std::make_unique<juce::AudioParameterFloat>(
+                    modPhaseParamID,
+                    "Mod Phase",
+                    juce::NormalisableRange<float> {0.0f, 180.0f, 1.0f},
+                    90.0f,
+                    juce::AudioParameterFloatAttributes().withStringFromValueFunction(stringFromDegrees)
+                    ));
+    layout.add(std::make_unique<juce::AudioParameterBool>(modSyncParamID, "Mod Sync", false));
+    layout.add(std::make_unique<juce::AudioParameterChoice>(modNoteParamID, "Mod Note", noteLengths, 9));
+    
     return layout;
 }
 
 //==============================================================================
-void Parameters::prepareToPlay(double sampleRate) noexcept
+void Parameters::prepareToPlay(double sampleRate, int maximumBlockSize)
 {
     /*          Linear Smoothing
       THe gainSmoother needs to know how long it should take to
@@ -177,6 +397,9 @@ void Parameters::prepareToPlay(double sampleRate) noexcept
     stereoSmoother.reset(sampleRate, duration);
     lowCutSmoother.reset(sampleRate, duration);
     highCutSmoother.reset(sampleRate, duration);
+    modDepthSmoother.reset(sampleRate, duration);
+    diffusionSmoother.reset(sampleRate, duration);
+    driveSmoother.reset(sampleRate, duration);
     
     /*
         Delay-Line Exponential Transition - filter Coefficient depends on sample rate
@@ -186,53 +409,104 @@ void Parameters::prepareToPlay(double sampleRate) noexcept
      */
     coeff = 1.0f - std::exp(-1.0f / (0.2f * float(sampleRate)));
     
-    
+    rampBuffer.setSize(numRampRows, maximumBlockSize);
 }
 
 
 void Parameters::reset() noexcept
 {
+    snapshotVersion = version.load(std::memory_order_acquire);
+    readSnapshot();
+    
     gain = 0.0f;
-    gainSmoother.setCurrentAndTargetValue(juce::Decibels::decibelsToGain((gainParam->get())));
+    gainSmoother.setCurrentAndTargetValue(snapshot.gain);
     
     mix = 1.0f;  // 100%, mixing in the wet signal fully
-    mixSmoother.setCurrentAndTargetValue(mixParam->get() * 0.01f); // Convert Percentage to number;
+    mixSmoother.setCurrentAndTargetValue(snapshot.mix);
     
     feedback = 0.0f;  // No feedback
-    feedbackSmoother.setCurrentAndTargetValue(feedbackParam->get() * 0.01f);
+    feedbackSmoother.setCurrentAndTargetValue(snapshot.feedback);
     
     panL = 0.0f;
     panR = 1.0f;
-    stereoSmoother.setCurrentAndTargetValue(stereoParam->get() * 0.01f);
+    stereoSmoother.setCurrentAndTargetValue(snapshot.stereo);
     
     lowCut = 20.0f;
-    lowCutSmoother.setCurrentAndTargetValue(lowCutParam->get());
+    lowCutSmoother.setCurrentAndTargetValue(snapshot.lowCut);
     
     highCut = 20000.0f;
-    highCutSmoother.setCurrentAndTargetValue(highCutParam->get());
+    highCutSmoother.setCurrentAndTargetValue(snapshot.highCut);
+    
+    modDepthSmoother.setCurrentAndTargetValue(modulation.depth);
+    diffusionSmoother.setCurrentAndTargetValue(snapshot.diffusion);
+    driveSmoother.setCurrentAndTargetValue(snapshot.drive);
 }
 // This function updates the parameters from the latest APTVS source - usally called once per block
-void Parameters::update() noexcept
+void Parameters::readSnapshot() noexcept
 {
-    targetDelayTime = delayTimeParam->get();
-    if(delayTime == 0.0f)
-        delayTime = targetDelayTime;
-    /*        The Gain
-    float gainInDecibels = gainParam->get(); // reads the current value from the parameter (address in APTVS)
-    float newGain = juce::Decibels::decibelsToGain(gainInDecibels);
-    gainSmoother.setTargetValue(newGain);// Tells smoother about new value. If it differs, smoother will get to work
-     */
-    gainSmoother.setTargetValue(juce::Decibels::decibelsToGain(gainParam->get()));
-    mixSmoother.setTargetValue(mixParam->get() * 0.01f);
-    feedbackSmoother.setTargetValue(feedbackParam->get() * 0.01f);
-    stereoSmoother.setTargetValue(stereoParam->get() * 0.01f);
-    lowCutSmoother.setTargetValue(lowCutParam->get());
-    highCutSmoother.setTargetValue(highCutParam->get());
+    // Reads the current value from each parameter (address in APTVS) & converts it once, here
+    snapshot.gain = juce::Decibels::decibelsToGain(gainParam->get());
+    snapshot.mix = mixParam->get() * 0.01f;  // Convert Percentage to number
+    snapshot.feedback = feedbackParam->get() * 0.01f;
+    snapshot.stereo = stereoParam->get() * 0.01f;
+    snapshot.lowCut = lowCutParam->get();
+    snapshot.highCut = highCutParam->get();
+    snapshot.diffusion = diffusionParam->get() * 0.01f;
+    snapshot.drive = driveParam->get() * 0.01f;
+    snapshot.delayTime = delayTimeParam->get();
+    
+    snapshot.delayNote = delayNoteParam->getIndex();
+    snapshot.quality = qualityParam->getIndex();
+    snapshot.timeChange = timeChangeParam->getIndex();
+    snapshot.tempoSync = tempoSyncParam->get();
+    
+    snapshot.bypassed = bypassParam->get();
+    snapshot.flushOnBypass = bypassModeParam->getIndex() == 1;
+    snapshot.freeze = freezeParam->get();
+    snapshot.reverse = reverseParam->get();
     
-    delayNote = delayNoteParam->getIndex();
-    tempoSync = tempoSyncParam->get();
+    taps.count = tapCountParam->get();
+    taps.swing = swingParam->get() * 0.01f;
+    for(size_t tap = 0; tap < maxTaps; ++tap){
+        taps.time[tap] = tapTimeParams[tap]->get();
+        taps.note[tap] = tapNoteParams[tap]->getIndex();
+        float level = tapLevelParams[tap]->get() * 0.01f;
+        float left, right;
+        panningEqualPowerFast(tapPanParams[tap]->get() * 0.01f, left, right);
+        taps.gainL[tap] = level * left;
+        taps.gainR[tap] = level * right;
+    }
+    
+    modulation.rate = modRateParam->get();
+    modulation.depth = modDepthParam->get();
+    modulation.phase = modPhaseParam->get() / 360.0f;
+    modulation.shape = modShapeParam->getIndex();
+    modulation.note = modNoteParam->getIndex();
+    modulation.sync = modSyncParam->get();
+}
+
+void Parameters::update() noexcept
+{
+    // Most blocks nothing changed, & the smoothers are already heading for the right values
+    auto currentVersion = version.load(std::memory_order_acquire);
+    if(currentVersion != snapshotVersion){
+        snapshotVersion = currentVersion;
+        readSnapshot();
+        
+        // Tells smoothers about new values. If they differ, the smoothers will get to work
+        gainSmoother.setTargetValue(snapshot.gain);
+        mixSmoother.setTargetValue(snapshot.mix);
+        feedbackSmoother.setTargetValue(snapshot.feedback);
+        stereoSmoother.setTargetValue(snapshot.stereo);
+        lowCutSmoother.setTargetValue(snapshot.lowCut);
+        highCutSmoother.setTargetValue(snapshot.highCut);
+        modDepthSmoother.setTargetValue(modulation.depth);
+        diffusionSmoother.setTargetValue(snapshot.diffusion);
+        driveSmoother.setTargetValue(snapshot.drive);
+    }
     
-    bypassed = bypassParam->get();
+    if(delayTime == 0.0f)
+        delayTime = snapshot.delayTime;
 }
 
 // Called once per sample
@@ -241,7 +515,7 @@ void Parameters::smoothen() noexcept
     gain = gainSmoother.getNextValue();
     mix = mixSmoother.getNextValue();
     feedback = feedbackSmoother.getNextValue();
-    panningEqualPower(stereoSmoother.getNextValue(), panL, panR);
+    panningEqualPowerFast(stereoSmoother.getNextValue(), panL, panR);
     lowCut = lowCutSmoother.getNextValue();
     highCut = highCutSmoother.getNextValue();
     
@@ -253,6 +527,48 @@ void Parameters::smoothen() noexcept
      With every timestep the distance between currentValue & targetValue become smaller & the movement slows
      down.Exponential shape: Starts out fast but the steps become smaller & smaller
      */
-    //delayTime += (targetDelayTime - delayTime) * coeff;
-    delayTime = targetDelayTime;  // Turn off parameter smoothing since it interferes with ducking
+    //delayTime += (snapshot.delayTime - delayTime) * coeff;
+    delayTime = snapshot.delayTime;  // Turn off parameter smoothing since it interferes with ducking
+                                     // (Time Change = Tape glides in the processor, in samples, so Tempo Sync glides too)
+}
+
+// Called once per block (or chunk) instead of calling smoothen() for every sample
+void Parameters::smoothen(int numSamples) noexcept
+{
+    jassert(numSamples > 0 && numSamples <= rampBuffer.getNumSamples());
+    
+    fillRamp(gainSmoother,     gainRamp,     rampBuffer.getWritePointer(gainRow),     numSamples);
+    fillRamp(mixSmoother,      mixRamp,      rampBuffer.getWritePointer(mixRow),      numSamples);
+    fillRamp(feedbackSmoother, feedbackRamp, rampBuffer.getWritePointer(feedbackRow), numSamples);
+    fillRamp(lowCutSmoother,   lowCutRamp,   rampBuffer.getWritePointer(lowCutRow),   numSamples);
+    fillRamp(highCutSmoother,  highCutRamp,  rampBuffer.getWritePointer(highCutRow),  numSamples);
+    fillRamp(modDepthSmoother, modDepthRamp, rampBuffer.getWritePointer(modDepthRow), numSamples);
+    fillRamp(diffusionSmoother, diffusionRamp, rampBuffer.getWritePointer(diffusionRow), numSamples);
+    fillRamp(driveSmoother, driveRamp, rampBuffer.getWritePointer(driveRow), numSamples);
+    
+    // Only compute the panning law per sample while the stereo knob is moving
+    if(stereoSmoother.isSmoothing()){
+        float* left  = rampBuffer.getWritePointer(panLRow);
+        float* right = rampBuffer.getWritePointer(panRRow);
+        fillLinear(stereoSmoother, left, numSamples);
+        panningEqualPowerFast(left, left, right, numSamples);  // panning values get replaced by the gains
+        panLRamp = { left,  left[numSamples - 1],  false };
+        panRRamp = { right, right[numSamples - 1], false };
+    }
+    else{
+        float left, right;
+        panningEqualPowerFast(stereoSmoother.getTargetValue(), left, right);
+        panLRamp = { nullptr, left,  true };
+        panRRamp = { nullptr, right, true };
+    }
+    
+    // Keep the per-sample variables up-to-date, they now hold the values of the last sample
+    gain = gainRamp.value;
+    mix = mixRamp.value;
+    feedback = feedbackRamp.value;
+    panL = panLRamp.value;
+    panR = panRRamp.value;
+    lowCut = lowCutRamp.value;
+    highCut = highCutRamp.value;
+    delayTime = snapshot.delayTime;
 }
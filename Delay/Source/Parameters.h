@@ -11,6 +11,8 @@
 
 #pragma once
 #include <JuceHeader.h> // so C++ compiler knows what juce:: means
+#include <array>
+#include <atomic>
 
 // Define the paramater ID as a constant that you can refer to later
 const juce::ParameterID gainParamID{"gain",1};
@@ -23,8 +25,29 @@ const juce::ParameterID highCutParamID("highCut", 1);
 const juce::ParameterID tempoSyncParamID("tempoSync", 1);
 const juce::ParameterID delayNoteParamID("delayNote", 1);
 const juce::ParameterID bypassParamID("bypass", 1);
+const juce::ParameterID bypassModeParamID("bypassMode", 1);
+const juce::ParameterID qualityParamID("quality", 1);
+const juce::ParameterID timeChangeParamID("timeChange", 1);
+const juce::ParameterID tapCountParamID("taps", 1);
+const juce::ParameterID swingParamID("swing", 1);
+const juce::ParameterID modRateParamID("modRate", 1);
+const juce::ParameterID modDepthParamID("modDepth", 1);
+const juce::ParameterID modShapeParamID("modShape", 1);
+const juce::ParameterID modPhaseParamID("modPhase", 1);
+const juce::ParameterID modSyncParamID("modSync", 1);
+const juce::ParameterID modNoteParamID("modNote", 1);
+const juce::ParameterID diffusionParamID("diffusion", 1);
+const juce::ParameterID driveParamID("drive", 1);
+const juce::ParameterID freezeParamID("freeze", 1);
+const juce::ParameterID reverseParamID("reverse", 1);
 
-class Parameters
+/** IDs of the settings of one extra tap: tap1Time, tap1Note, tap1Level, tap1Pan, tap2Time, ...
+    tap counts from 0, the IDs from 1. */
+inline juce::ParameterID tapParamID(int tap, const char* setting){
+    return { "tap" + juce::String(tap + 1) + setting, 1 };
+}
+
+class Parameters : private juce::AudioProcessorParameter::Listener
 {
 public:
     //==============================================================================
@@ -35,15 +58,97 @@ public:
     
     //==============================================================================
     Parameters(juce::AudioProcessorValueTreeState& apvts);
+    ~Parameters() override;
     
     
     //==============================================================================
-    void prepareToPlay(double sampleRate) noexcept;
+    void prepareToPlay(double sampleRate, int maximumBlockSize);
+    
+    /** Reads the parameters into the snapshot & updates the smoothers, but only if one of them
+        changed since the last call. Otherwise it costs one atomic load. */
     void update() noexcept;
     void reset() noexcept;
     void smoothen() noexcept;
     
-    // The public-facing variables to be used in Processing block
+    /** Block version of smoothen(): steps every smoother over numSamples samples at once.
+        Parameters that aren't moving are reported as constant & cost nothing per sample.
+        numSamples may not be larger than the maximumBlockSize given to prepareToPlay.
+     */
+    void smoothen(int numSamples) noexcept;
+    
+    /** Where the delay time & feedback are heading, as set by the last update() */
+    float getTargetDelayTime() const noexcept{
+        return snapshot.delayTime;
+    }
+    float getTargetFeedback() const noexcept{
+        return feedbackSmoother.getTargetValue();
+    }
+    
+    /** The values of one smoothed parameter over a block, filled in by smoothen(numSamples) */
+    struct Ramp
+    {
+        const float* values = nullptr;  // One value per sample. Only filled in if !isConstant
+        float value = 0.0f;             // Value for the whole block if isConstant, else the last value
+        bool isConstant = true;
+    };
+    Ramp gainRamp, mixRamp, feedbackRamp, panLRamp, panRRamp, lowCutRamp, highCutRamp, modDepthRamp, diffusionRamp, driveRamp;
+    
+    /** How the delay gets to a new delay time, in the order of the Time Change choices */
+    enum TimeChange { duck, crossfade, tape };
+    
+    /** Every parameter value as of the last update(), converted to the units the DSP works in.
+        Kept together on one cache line, so the processing code never touches the parameter objects. */
+    struct alignas(64) Snapshot
+    {
+        float gain      = 1.0f;      // linear, not dB
+        float mix       = 1.0f;      // 0 - 1
+        float feedback  = 0.0f;      // -1 - 1
+        float stereo    = 0.0f;      // -1 - 1
+        float lowCut    = 20.0f;     // Hz
+        float highCut   = 20000.0f;  // Hz
+        float diffusion = 0.0f;      // 0 - 1
+        float drive     = 0.0f;      // 0 - 1
+        float delayTime = 0.0f;      // ms
+        int   delayNote = 0;
+        int   quality   = 1;         // Interpolation::Type used to read the delay lines
+        int   timeChange = duck;     // TimeChange
+        bool  tempoSync = false;
+        bool  bypassed  = false;
+        bool  flushOnBypass = false; // Bypass Mode: empty the delay line once bypassed, instead of freezing it
+        bool  freeze    = false;     // loop what's in the delay line, see DelayAudioProcessor::readLoop()
+        bool  reverse   = false;     // play the echoes backwards, see DelayAudioProcessor::readReverse()
+    };
+    Snapshot snapshot;
+    
+    // Multi-tap: up to maxTaps extra taps, read from the same delay line as the delay itself
+    static constexpr int maxTaps = 8;
+    
+    /** The multi-tap parameters as of the last update(). One array per setting, so the processor loops
+        over the taps without picking the fields out of structs. Only the first count taps are in use. */
+    struct Taps
+    {
+        int count = 0;
+        float swing = 0.0f;                    // 0 - 1
+        std::array<float, maxTaps> time{};     // ms
+        std::array<int, maxTaps> note{};       // note length for Tempo Sync
+        std::array<float, maxTaps> gainL{};    // level & pan combined, linear
+        std::array<float, maxTaps> gainR{};
+    };
+    Taps taps;
+    
+    /** The settings of the LFO that modulates the delay time, as of the last update() */
+    struct Modulation
+    {
+        float rate  = 0.5f;    // Hz
+        float depth = 0.0f;    // ms, 0 is off
+        float phase = 0.25f;   // offset of the right lane, 0 - 1 of a cycle
+        int   shape = 0;       // LFO::Shape
+        int   note  = 9;       // note length of one cycle for Mod Sync
+        bool  sync  = false;
+    };
+    Modulation modulation;
+    
+    // The smoothed values of the last sample, to be used in Processing block
     float gain      = 0.0f;
     float delayTime = 0.0f;
     float mix       = 1.0f;  // % of wet mixed into dry
@@ -52,9 +157,6 @@ public:
     float panR      = 1.0f;
     float lowCut    = 20.0f;
     float highCut   = 20000.0f;
-    int   delayNote = 0;
-    bool  tempoSync = false;
-    bool  bypassed  = false;
     
     // List of Public addresses where are Parameters are stored in APVTS, that will be used as listeners
     juce::AudioParameterBool*  tempoSyncParam;
@@ -62,9 +164,24 @@ public:
     
     // constants
     static constexpr float minDelayTime = 5.0f;
-    static constexpr float maxDelayTime = 5000.0f;   // expressed in milliseconds
+    static constexpr float maxDelayTime = 60000.0f;  // expressed in milliseconds
+    static constexpr float maxModDepth = 10.0f;      // ms the LFO can add to the delay time
     
 private:
+    /** Reads every parameter into the snapshot */
+    void readSnapshot() noexcept;
+    
+    static constexpr int numParameters = 25 + 4 * maxTaps;
+    std::array<juce::AudioProcessorParameter*, numParameters> allParameters() const noexcept;
+    
+    // Called by any parameter that changes, on whatever thread changed it
+    void parameterValueChanged(int parameterIndex, float newValue) override;
+    void parameterGestureChanged(int, bool) override {}
+    
+    // Goes up by one for every parameter change. update() only reads the parameters if it moved.
+    std::atomic<juce::uint32> version { 1 };
+    juce::uint32 snapshotVersion = 0;
+    
     //=====     List of Addresses where Parameters are stored in APVTS   ============
     juce::AudioParameterFloat* gainParam;
     juce::AudioParameterFloat* delayTimeParam;
@@ -73,8 +190,29 @@ private:
     juce::AudioParameterFloat* stereoParam;
     juce::AudioParameterFloat* lowCutParam;
     juce::AudioParameterFloat* highCutParam;
+    juce::AudioParameterFloat* diffusionParam;
+    juce::AudioParameterFloat* driveParam;
     
     juce::AudioParameterChoice* delayNoteParam;
+    juce::AudioParameterChoice* qualityParam;
+    juce::AudioParameterChoice* bypassModeParam;
+    juce::AudioParameterBool* freezeParam;
+    juce::AudioParameterBool* reverseParam;
+    juce::AudioParameterChoice* timeChangeParam;
+    
+    juce::AudioParameterInt*   tapCountParam;
+    juce::AudioParameterFloat* swingParam;
+    std::array<juce::AudioParameterFloat*, maxTaps>  tapTimeParams;
+    std::array<juce::AudioParameterChoice*, maxTaps> tapNoteParams;
+    std::array<juce::AudioParameterFloat*, maxTaps>  tapLevelParams;
+    std::array<juce::AudioParameterFloat*, maxTaps>  tapPanParams;
+    
+    juce::AudioParameterFloat*  modRateParam;
+    juce::AudioParameterFloat*  modDepthParam;
+    juce::AudioParameterChoice* modShapeParam;
+    juce::AudioParameterFloat*  modPhaseParam;
+    juce::AudioParameterBool*   modSyncParam;
+    juce::AudioParameterChoice* modNoteParam;
     
     //==============================================================================
     // Mechanic to avoid discrete jumps whenever paramter is changed. solves zipper noise
@@ -84,10 +222,16 @@ private:
     juce::LinearSmoothedValue<float> stereoSmoother;
     juce::LinearSmoothedValue<float> lowCutSmoother;
     juce::LinearSmoothedValue<float> highCutSmoother;
+    juce::LinearSmoothedValue<float> modDepthSmoother;  // a jump in depth would jump the read position
+    juce::LinearSmoothedValue<float> diffusionSmoother;
+    juce::LinearSmoothedValue<float> driveSmoother;
+    
+    // Storage for the ramps, one row per smoothed parameter
+    enum RampRow { gainRow, mixRow, feedbackRow, panLRow, panRRow, lowCutRow, highCutRow, modDepthRow, diffusionRow, driveRow, numRampRows };
+    juce::AudioBuffer<float> rampBuffer;
     
     // Exponential Transition for Delay-Time
     float coeff = 0.0f;   // one-pole smoothing: determines how fast the smoothing happens
-    float targetDelayTime = 0.0f; // The value that the one-pole filter is trying to reach
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Parameters)
 
@@ -7,8 +7,18 @@
 */
 
 #include "PluginProcessor.h"
-#include "PluginEditor.h"
 #include "ProtectYourEars.h"
+#include "DSP.h"
+
+/*  Build flag for the command-line tools (DelayRender, DelayBenchmark, DelayTests), which are built without
+    the editor & its GUI sources. DELAY_HEADLESS=1 in their Projucer preprocessor definitions. */
+#ifndef DELAY_HEADLESS
+ #define DELAY_HEADLESS 0
+#endif
+
+#if !DELAY_HEADLESS
+ #include "PluginEditor.h"
+#endif
 
 //==============================================================================
 DelayAudioProcessor::DelayAudioProcessor() 
@@ -19,8 +29,6 @@ DelayAudioProcessor::DelayAudioProcessor()
       ),
     params(apvts)
 {
-    lowCutFilter.setType(juce::dsp::StateVariableTPTFilterType::highpass);
-    highCutFilter.setType(juce::dsp::StateVariableTPTFilterType::lowpass);
 }
 
 DelayAudioProcessor::~DelayAudioProcessor()
@@ -60,9 +68,10 @@ bool DelayAudioProcessor::isMidiEffect() const
    #endif
 }
 
+// Updated by the audio thread, see updateTailLength()
 double DelayAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    return tailLengthSeconds.load();
 }
 
 int DelayAudioProcessor::getNumPrograms()
@@ -92,60 +101,93 @@ void DelayAudioProcessor::changeProgramName (int, const juce::String&)
 //==============================================================================
 // This is the plug-in’s chance to get everything ready to go before it starts receiving audio.
 // Prepare all internal resources
-void DelayAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+void DelayAudioProcessor::prepareToPlay (double sampleRate, [[maybe_unused]] int samplesPerBlock)
 {
     // Use this method as the place to do any pre-playback initialisation that you need..
     
     // Prepare all parameter supporters
-    params.prepareToPlay(sampleRate);
     params.reset();
     tempo.reset();
     
-    /* JUCE DSP objects must always be prepared before they can be used */
-    // DSP objects Need Spec
-    juce::dsp::ProcessSpec spec;
-    spec.sampleRate = sampleRate;
-    spec.maximumBlockSize = juce::uint32(samplesPerBlock);
-    spec.numChannels = 2;
-    //delayLine.prepare(spec);
-    lowCutFilter.prepare(spec);
-    highCutFilter.prepare(spec);
-    
-    // DelayLine
-    double numSamples = Parameters::maxDelayTime / 1000.0 * sampleRate;
+    feedbackFilters.prepare(sampleRate);
+    diffuser.prepare(sampleRate);
+    lfo.prepare(sampleRate);
+    
+    // DelayLine, with room for the modulation on top of the longest delay
+    double numSamples = (Parameters::maxDelayTime + Parameters::maxModDepth) / 1000.0 * sampleRate;
     int maxDelayInSamples = int(std::ceil(numSamples));
-    delayLineL.setMaximumDelayInSamples(maxDelayInSamples);
-    delayLineR.setMaximumDelayInSamples(maxDelayInSamples);
+    delayLine.setMaximumDelayInSamples(maxDelayInSamples);
+    historySamples = int(historyTime * sampleRate);
+
+    // Staged processing: chunks may not be longer than the shortest delay (see processChunk),
+    // & they follow the control grid, not the host's block size (see processChunks)
+    int minDelayInSamples = int(Parameters::minDelayTime / 1000.0f * float(sampleRate));
+    maxChunkSize = std::max(1, std::min(controlInterval, minDelayInSamples - 1));
+    controlPosition = 0;
+    feedbackFilters.setControlInterval(maxChunkSize);  // new cutoffs once per grid cell, like the other controls
+    scratch.setSize(numScratchRows, maxChunkSize);
+    stereoScratch.resize(size_t(numStereoRows * maxChunkSize));
     
+    // Tape glide: the one-pole filter leaves exp(-n / (glideTime * sampleRate)) of the distance after n samples
+    glideDecay.resize(size_t(maxChunkSize));
+    for(int i = 0; i < maxChunkSize; ++i)
+        glideDecay[size_t(i)] = float(std::exp(-double(i + 1) / (double(glideTime) * sampleRate)));
+    params.prepareToPlay(sampleRate, maxChunkSize);
+    idle = false;
+
     /*         Reset all params & variables        */
     
     // Delay Line Params
-    delayInSamples = 0.0f;
-    targetDelay = 0.0f;
+    state.delayInSamples = 0.0f;
+    state.targetDelay = 0.0f;
     
     // fading applied to feedback
-    fade = 1.0;          // Current wet signal envelope level
-    fadeTarget = 1.0f;
+    state.fade = 1.0;          // Current wet signal envelope level
+    state.fadeTarget = 1.0f;
     
-    coeff = 1.0 - std::exp(-1.0f /(0.05 * float(sampleRate)));
+    state.coeff = 1.0 - std::exp(-1.0f /(0.05 * float(sampleRate)));
     
     // waiting variables determine how long to hold ducking until fading back in
-    wait = 0.0f;
-    waitInc = 1.0 / (0.3f * float(sampleRate)); // 300 ms. At 48 kHz, 0.3 * 48k = 14,400 samples.
-                                                // 300ms corresponds to 14,400 timesteps
+    state.wait = 0.0f;
+    state.waitInc = 1.0 / (0.3f * float(sampleRate)); // 300 ms. At 48 kHz, 0.3 * 48k = 14,400 samples.
+                                                      // 300ms corresponds to 14,400 timesteps
+    
+    // or crossfading instead of ducking
+    state.oldDelay = 0.0f;
+    state.xfade = 0.0f;
+    state.glideOffset = -1;
+    state.xfadeInc = 1.0f / (crossfadeTime * float(sampleRate));
+    state.xfadeStep = state.xfadeInc;
+    state.loopLength = 0;
+    state.resumeFade = 0;
+    
+    // Reverse starts out where its switch is, with fresh grains
+    state.reverseMix = params.snapshot.reverse ? 1.0f : 0.0f;
+    state.reversed = params.snapshot.reverse;
+    state.grainHalf = 0;
+    state.grainPosition = 0;
     
     // Clear out any old sample values from the stereo feedback path
-    feedbackL = 0.0f;
-    feedbackR = 0.0f;
+    state.feedback = StereoSample();
+    state.quietSamples = 0;
+    taps = Taps();
+    
+    // Start out where the bypass switch is, without a crossfade
+    state.bypassMix = params.snapshot.bypassed ? 1.0f : 0.0f;
+    dspBypassed = params.snapshot.bypassed;
+    state.bypassInc = 1.0f / (bypassFadeTime * float(sampleRate));
     
     // Audio Level Meters
     levelL.reset();
     levelR.reset();
     
-    delayLineL.reset();
-    delayLineR.reset();
-    lowCutFilter.reset();
-    highCutFilter.reset();
+    delayLine.reset();
+    allpass.reset();
+    oldAllpass.reset();
+    feedbackFilters.reset();
+    
+    // Until the first block knows the real delay time, assume the longest one
+    updateTailLength(Parameters::maxDelayTime, params.getTargetFeedback(), 0.0f);
 }
 
 void DelayAudioProcessor::releaseResources()
@@ -175,7 +217,6 @@ bool DelayAudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts) con
 void DelayAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, [[maybe_unused]] juce::MidiBuffer& midiMessages)
 {
     juce::ScopedNoDenormals noDenormals;
-    float sampleRate = getSampleRate();
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
 
@@ -189,8 +230,7 @@ void DelayAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, [[mayb
     /* This is the place where you'd normally do the guts of your plugin's audio processing...  */
     params.update(); // reads the most recent parameter values, updating target value of any smoothers
     tempo.update(getPlayHead());
-    float syncedTime = std::min<float>(tempo.getMillisecondsforNoteLength(params.delayNote),
-                                       Parameters::maxDelayTime);
+    float syncedTime = syncedDelayTime();
     float maxL = 0.0f; // Used to measure peak level for current block
     float maxR = 0.0f;
     
@@ -211,163 +251,822 @@ void DelayAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, [[mayb
     float* outputDataL = mainOutput.getWritePointer(0);
     float* outputDataR = mainOutput.getWritePointer(isMainOutputStereo ? 1 : 0);
     
+    float delayTime = params.snapshot.tempoSync ? syncedTime : params.getTargetDelayTime();
+    bool frozen = params.snapshot.freeze || state.loopLength > 0;
+    updateTailLength(delayTime, std::max(std::abs(params.feedback), std::abs(params.getTargetFeedback())),
+                     float(taps.longest) * 1000.0f / float(getSampleRate()));
+    
+    // Bypassed: the DSP stopped on the control grid (see processChunks) & starts again once Bypass is off
+    dspBypassed = dspBypassed && params.snapshot.bypassed;
+    if(dspBypassed){
+        passThrough(mainOutput, 0, buffer.getNumSamples(), !isMainInputStereo && isMainOutputStereo);
+        return;
+    }
+    
+    /* Idle: the input is silent & the tail has died out, so the output would be silent too.
+       Skip all the DSP & just clear the output until the input comes back. */
+    bool inputSilent = mainInput.getMagnitude(0, buffer.getNumSamples()) < silenceThreshold;
+    if(idle){
+        if(inputSilent){
+            mainOutput.clear();
+            state.bypassMix = params.snapshot.bypassed ? 1.0f : 0.0f;  // silent either way, no need to crossfade
+            controlPosition = (controlPosition + buffer.getNumSamples()) % maxChunkSize;
+            return;
+        }
+        wakeUp();
+    }
+    
     /*        Processing Loop          */
-    if(isMainInputStereo){  //  Stereo Audio processing loop
-        for(int sample = 0; sample < buffer.getNumSamples(); sample++){
-            params.smoothen();  // Smooth motion prevents zipper noise
-            
-            // Update Delay Line
-            float delayTime = params.tempoSync ? syncedTime : params.delayTime;
-            float newTargetDelay = delayTime / 1000.0f * sampleRate;
-            
-            // Decide whether to perform ducking
-            if(newTargetDelay != targetDelay){
-                targetDelay = newTargetDelay;
-                if(delayInSamples == 0.0f)  // first time
-                    delayInSamples = targetDelay;
-                else{ // start fading out & reset wait period
-                    wait       = waitInc; // start counter
-                    fadeTarget = 0.0;  // Initiates fade out & activates one-pole filter
-                }
-                
+    // Every bus layout runs the full stereo engine, each one with its own compiled kernel
+    int numProcessed;
+    if(isMainInputStereo)
+        numProcessed = processChunks<2, 2>(inputDataL, inputDataR, outputDataL, outputDataR, buffer.getNumSamples(), syncedTime, maxL, maxR);
+    else if(isMainOutputStereo)
+        numProcessed = processChunks<1, 2>(inputDataL, inputDataR, outputDataL, outputDataR, buffer.getNumSamples(), syncedTime, maxL, maxR);
+    else
+        numProcessed = processChunks<1, 1>(inputDataL, inputDataR, outputDataL, outputDataR, buffer.getNumSamples(), syncedTime, maxL, maxR);
+    
+    levelL.updateIfGreater(maxL);
+    levelR.updateIfGreater(maxR);
+    
+    // Nothing above the silence threshold is left anywhere the delay line can still read from
+    float modulationSamples = std::max(params.modDepthRamp.value, params.modulation.depth) / 1000.0f * float(getSampleRate());
+    int grainSamples = state.grainHalf > 0 ? 2 * maxChunkSize + 4 * state.grainHalf : 0;  // see readReverse()
+    int readableSamples = std::max({int(std::max({state.delayInSamples, state.targetDelay, state.oldDelay}) + modulationSamples),
+                                    taps.longest, state.loopLength + state.loopFade, grainSamples}) + 4;
+    idle = !frozen && inputSilent && state.wait == 0.0f && state.xfade == 0.0f && state.quietSamples > readableSamples;
+    
+    // Hand back the pages of the delay line that are too old to be read, keeping some history for turning the delay up
+    delayLine.releaseOlderThan(readableSamples + historySamples);
+    
+    // The crossfade to dry ended before the end of the block
+    if(numProcessed < buffer.getNumSamples())
+        passThrough(mainOutput, numProcessed, buffer.getNumSamples() - numProcessed, !isMainInputStereo && isMainOutputStereo);
+    
+    #if JUCE_DEBUG
+    protectYourEars(buffer);  // Techniacally not allowed in audio thread (its slow w system calls)
+                              // However statement prints something in an exceptional situation, so it OK
+    #endif
+}
+
+// Delay time of the note length for Tempo Sync.
+// Clamped to the parameter's range, which also keeps the chunks of processChunk() valid
+float DelayAudioProcessor::syncedDelayTime() const noexcept
+{
+    return std::clamp<float>(tempo.getMillisecondsforNoteLength(params.snapshot.delayNote),
+                             Parameters::minDelayTime, Parameters::maxDelayTime);
+}
+
+/* Bypassed: the crossfade to dry is over, so the output is just the input & none of the DSP runs.
+   Freeze leaves the delay line as it is, so the echoes carry on when the delay comes back.
+   Flush empties it once, after which the engine is idle & comes back from silence. */
+void DelayAudioProcessor::passThrough(juce::AudioBuffer<float>& output, int startSample, int numSamples, bool monoToStereo) noexcept
+{
+    if(monoToStereo)
+        output.copyFrom(1, startSample, output, 0, startSample, numSamples);
+    levelL.updateIfGreater(output.getMagnitude(0, startSample, numSamples));
+    levelR.updateIfGreater(output.getMagnitude(output.getNumChannels() > 1 ? 1 : 0, startSample, numSamples));
+    if(params.snapshot.flushOnBypass && !idle){
+        delayLine.reset();
+        idle = true;
+    }
+    state.glideOffset = -1;  // a glide picks up again from wherever the delay time got to
+    controlPosition = (controlPosition + numSamples) % maxChunkSize;
+}
+
+// Cuts the block into chunks, see processChunk(). Returns how many samples it processed
+template<int numInputChannels, int numOutputChannels>
+int DelayAudioProcessor::processChunks(const float* inputL, const float* inputR, float* outputL, float* outputR,
+                                       int numSamples, float syncedTime, float& maxL, float& maxR) noexcept
+{
+    // The chunks end on the control grid, every maxChunkSize samples of the stream. The parameters are read at the
+    // start of the block (in processBlock) & at every grid point, so a change made while a long block is being
+    // processed is picked up within maxChunkSize samples. Costs one atomic load when nothing changed.
+    for(int offset = 0; offset < numSamples;){
+        if(controlPosition == 0){
+            if(offset > 0){
+                params.update();
+                syncedTime = syncedDelayTime();
             }
-            
-            // Update SVF filters
-            if(params.lowCut != lastLowCut) // Only update/modify filter if Cut freq changed from last time
-            {
-                lowCutFilter.setCutoffFrequency(params.lowCut);
-                lastLowCut = params.lowCut;
+            // The crossfade to dry is over, the rest of the block is passed through
+            if(params.snapshot.bypassed && state.bypassMix == 1.0f){
+                dspBypassed = true;
+                return offset;
             }
-            if(params.highCut != lastHighCut){
-                highCutFilter.setCutoffFrequency(params.highCut);
-                lastHighCut = params.highCut;
+        }
+        int chunkSize = std::min(maxChunkSize - controlPosition, numSamples - offset);
+        processChunk<numInputChannels, numOutputChannels>(inputL + offset, inputR + offset,
+                                                          outputL + offset, outputR + offset,
+                                                          chunkSize, syncedTime, maxL, maxR);
+        offset += chunkSize;
+        controlPosition = (controlPosition + chunkSize) % maxChunkSize;
+    }
+    return numSamples;
+}
+    
+
+/*
+    Runs the stereo signal chain for one chunk of samples, one stage at a time:
+        1. parameter ramps (smoothing, delay time & ducking envelope or crossfade)
+        2. LFO modulation & interpolated read of the wet signal (two delay times while crossfading),
+           or the reversed grains
+        3. feedback gain, low/high-cut filters, saturation & diffusion
+        4. extra taps of the multi-tap, added to the wet signal only
+        5. delay-line write of input + (ping-pong) feedback
+        6. dry/wet mix, output gain & peak metering
+    With Freeze on, stages 1 - 5 are replaced by a copy of the loop. The wet signal is read before the
+    chunk is written, which is fine because a chunk is never longer than the shortest delay (maxChunkSize).
+    Mono input feeds both lanes, mono output gets both lanes folded down.
+ */
+template<int numInputChannels, int numOutputChannels>
+void DelayAudioProcessor::processChunk(const float* inputL, const float* inputR, float* outputL, float* outputR,
+                                       int numSamples, float syncedTime, float& maxL, float& maxR) noexcept
+{
+    static_assert(numInputChannels == 1 || numInputChannels == 2);
+    static_assert(numOutputChannels == 1 || numOutputChannels == 2);
+    
+    jassert(numSamples <= maxChunkSize);
+    
+    // Interleave the dry signal first, the output channels may share memory with the input channels
+    StereoSample* dry = stereoRow(dryRow);
+    float* mono = scratch.getWritePointer(monoRow);
+    if constexpr (numInputChannels == 2){
+        for(int i = 0; i < numSamples; ++i){
+            dry[i] = { inputL[i], inputR[i] };
+            mono[i] = (inputL[i] + inputR[i]) * 0.5f;  // convert stereo to mono
+        }
+    }
+    else{
+        for(int i = 0; i < numSamples; ++i){
+            float input = inputL[i];
+            dry[i] = { input, input };
+            mono[i] = input;
+        }
+    }
+    
+    // A loop that's near its end plays on to the start first, so there's room to fade it out, see stopLoop()
+    int loopLeft = state.loopLength - state.loopPosition;
+    int loopFadeOut = std::min(int(crossfadeTime * float(getSampleRate())), state.loopLength - maxChunkSize);
+    bool frozen = state.delayInSamples > 0.0f
+                  && (params.snapshot.freeze || (state.loopLength > 0 && (loopLeft <= maxChunkSize || loopLeft < loopFadeOut)));
+    if(frozen){
+        params.smoothen(numSamples);  // only mix & gain are used, but all smoothers keep moving
+        readLoop(numSamples);
+        state.glideOffset = -1;
+    }
+    else{
+        if(state.loopLength > 0)
+            stopLoop();
+        computeRamps(numSamples, syncedTime);
+        // Skipping the forward read also stops the LFO, so that only starts on the grid, not wherever the crossfade ends
+        if(controlPosition == 0 || !params.snapshot.reverse)
+            state.reversed = params.snapshot.reverse && state.reverseMix == 1.0f;
+        if(!state.reversed)
+            readDelayLines(numSamples);
+        if(params.snapshot.reverse || state.reverseMix > 0.0f)
+            readReverse(numSamples);
+        applyFeedbackFilters(numSamples);
+        addTaps(numSamples);
+        writeDelayLines(numSamples);
+    }
+    
+    // Create mix. Mixing the processed audio with the original dry sound is called the dry/wet mix
+    // Then apply the final gain
+    const StereoSample* wet = stereoRow(wetRow);
+    if(state.bypassMix == 0.0f && !params.snapshot.bypassed){
+        if(params.mixRamp.isConstant && params.gainRamp.isConstant){
+            float mix  = params.mixRamp.value;
+            float gain = params.gainRamp.value;
+            for(int i = 0; i < numSamples; ++i){
+                writeOutput<numOutputChannels>(outputL, outputR, i, (dry[i] + wet[i] * mix) * gain);
             }
-            
-            
-            // WE need to proc L & R channel at the same time so that the same smoothed param is applied
-            
-            float dryL = inputDataL[sample];    // Dry sample: What we call the unprocessed audio
-            float dryR = inputDataR[sample];
-            
-            // convert stereo to mono
-            float mono = (dryL + dryR) * 0.5f;
-            
-            // Add the sample coming from the feedback path to the dry signal, and put sum in delay line
-            // push the mono signal into the delay line
-            // Ping-Poing feedback: Notice we are feedback R to the left channels delay line
-            delayLineL.write(mono*params.panL + feedbackR);
-            delayLineR.write(mono*params.panR + feedbackL);
-            
-            // Wet sample: What we call processed signals
-            float wetL = delayLineL.read(delayInSamples);
-            float wetR = delayLineR.read(delayInSamples);
-            
-            /* Slowly & smoothly move the value of fade towards fadeTarget
-               Only happens while ducking, otherwise fade stays same value
-             */
-            fade += (fadeTarget - fade) * coeff;   // one-pole filter formula.
-            
-            /* Apply fade as envelope of wet signal.
-             Most of the time fade = 1, and nothing happens to delayed sound
-             However, when we're ducking, the wet signal is suppressed
-            */
-            wetL *= fade;
-            wetR *= fade;
-            
-            if(wait > 0.0f){
-                wait += waitInc;
-                if(wait >= 1.0f){
-                    // Holding period is over. Switch to new delay length and start fading it in
-                    delayInSamples = targetDelay;
-                    wait = 0.0f;
-                    fadeTarget = 1.0f; // fade in
-                }
+        }
+        else{
+            const float* mix  = rampValues(params.mixRamp, mixRow, numSamples);
+            const float* gain = rampValues(params.gainRamp, gainRow, numSamples);
+            for(int i = 0; i < numSamples; ++i){
+                writeOutput<numOutputChannels>(outputL, outputR, i, (dry[i] + wet[i] * mix[i]) * gain[i]);
             }
-            
-            /* Read output from delay line, and:
-                -apply low/high-cut filters
-                -apply feedback gain to get new feedback sample
-              Note that what we're writing to feedback isnt used until next iteration of loop.
-             */
-            feedbackL = wetL * params.feedback;
-            feedbackL =  lowCutFilter.processSample(0, feedbackL);
-            feedbackL = highCutFilter.processSample(0, feedbackL);
-            
-            feedbackR = wetR * params.feedback;
-            feedbackR =  lowCutFilter.processSample(1, feedbackR);
-            feedbackR = highCutFilter.processSample(1, feedbackR);
-            
-            // Create mix. Mixing the processed audio with the original dry sound is called the dry/wet mix
-            float mixL = dryL + wetL * params.mix;
-            float mixR = dryR + wetR * params.mix;
-            
-            // Apply the final gain
-            float outL = mixL * params.gain;
-            float outR = mixR * params.gain;
-            
-            /* In Bypass Mode, we still need all the calcualations to create the wet signal to maintain state
-               However, we only output the dry signal
-             */
-            if(params.bypassed){
-                outL = dryL;
-                outR = dryR;
+        }
+    }
+    else{
+        /* Crossfading into or out of Bypass. The delay keeps running underneath, so the echoes
+           fade out (or back in) smoothly instead of being cut off */
+        const float* mix  = rampValues(params.mixRamp, mixRow, numSamples);
+        const float* gain = rampValues(params.gainRamp, gainRow, numSamples);
+        float step = params.snapshot.bypassed ? state.bypassInc : -state.bypassInc;
+        for(int i = 0; i < numSamples; ++i){
+            state.bypassMix = std::clamp(state.bypassMix + step, 0.0f, 1.0f);
+            StereoSample processed = (dry[i] + wet[i] * mix[i]) * gain[i];
+            writeOutput<numOutputChannels>(outputL, outputR, i, processed + (dry[i] - processed) * state.bypassMix);
+        }
+    }
+    
+    // Keep track of the peaks (will be communicated to Editor)
+    auto rangeL = juce::FloatVectorOperations::findMinAndMax(outputL, numSamples);
+    maxL = std::max({maxL, -rangeL.getStart(), rangeL.getEnd()});
+    if constexpr (numOutputChannels == 2){
+        auto rangeR = juce::FloatVectorOperations::findMinAndMax(outputR, numSamples);
+        maxR = std::max({maxR, -rangeR.getStart(), rangeR.getEnd()});
+    }
+    else
+        maxR = maxL;
+}
+
+const float* DelayAudioProcessor::rampValues(const Parameters::Ramp& ramp, ScratchRow row, int numSamples) noexcept
+{
+    if(!ramp.isConstant)
+        return ramp.values;
+    
+    float* values = scratch.getWritePointer(row);
+    juce::FloatVectorOperations::fill(values, ramp.value, numSamples);
+    return values;
+}
+
+/*
+    Stage 1: steps the smoothers & the ducking state machine (or the crossfade) over the chunk.
+    Most of the time nothing is moving, and the ramps are constant for the whole chunk.
+ */
+void DelayAudioProcessor::computeRamps(int numSamples, float syncedTime) noexcept
+{
+    params.smoothen(numSamples);  // Smooth motion prevents zipper noise
+    
+    // Update Delay Line. The delay time can only change from one chunk to the next.
+    float sampleRate = float(getSampleRate());
+    float delayTime = params.snapshot.tempoSync ? syncedTime : params.delayTime;
+    float newTargetDelay = delayTime / 1000.0f * sampleRate;
+    
+    // Decide whether to perform ducking
+    bool newTarget = newTargetDelay != state.targetDelay;
+    if(newTarget){
+        state.targetDelay = newTargetDelay;
+        if(state.delayInSamples == 0.0f)  // first time
+            state.delayInSamples = state.targetDelay;
+        else if(params.snapshot.timeChange == Parameters::duck){ // start fading out & reset wait period
+            state.wait       = state.waitInc; // start counter
+            state.fadeTarget = 0.0;  // Initiates fade out & activates one-pole filter
+        }
+    }
+    
+    // Crossfade: switch to the new delay time right away & fade out the old one.
+    // A change that comes in during a crossfade waits for it to finish & the next point of the control grid.
+    if(params.snapshot.timeChange == Parameters::crossfade && state.delayInSamples != state.targetDelay
+       && state.xfade == 0.0f && state.wait == 0.0f && (newTarget || controlPosition == 0)){
+        state.oldDelay = state.delayInSamples;
+        state.delayInSamples = state.targetDelay;
+        state.xfade = 1.0f;
+        state.xfadeStep = state.xfadeInc;
+        state.xfadeCount = 0;
+        oldAllpass = allpass;  // the old tap carries on with the allpass state it has built up
+    }
+    crossfading = state.xfade > 0.0f;
+    if(crossfading)
+        computeCrossfade(numSamples);
+    
+    float* delay    = scratch.getWritePointer(delayRow);
+    float* envelope = scratch.getWritePointer(fadeRow);
+    
+    // Tape: the delay time glides to the new one, which bends the pitch of the echoes while it moves
+    bool gliding = params.snapshot.timeChange == Parameters::tape && state.wait == 0.0f
+                   && state.delayInSamples != state.targetDelay;
+    if(gliding){
+        if(newTarget || controlPosition == 0 || state.glideOffset < 0){
+            state.glideDistance = state.delayInSamples - state.targetDelay;
+            state.glideOffset = 0;
+        }
+        glideDelay(delay, numSamples);
+    }
+    else
+        state.glideOffset = -1;
+    
+    // Not ducking & the fade has settled: another step of the one-pole filter would not change it
+    if(state.wait == 0.0f && state.fade + (state.fadeTarget - state.fade) * state.coeff == state.fade){
+        if(!gliding)
+            juce::FloatVectorOperations::fill(delay, state.delayInSamples, numSamples);
+        fadeRamp = { nullptr, state.fade, true };
+        return;
+    }
+    
+    for(int i = 0; i < numSamples; ++i){
+        if(!gliding)  // ducking only starts with a new delay time, so it can't stop a glide halfway
+            delay[i] = state.delayInSamples;
+        
+        /* Slowly & smoothly move the value of fade towards fadeTarget
+           Only happens while ducking, otherwise fade stays same value
+         */
+        state.fade += (state.fadeTarget - state.fade) * state.coeff;   // one-pole filter formula.
+        envelope[i] = state.fade;
+        
+        if(state.wait > 0.0f){
+            state.wait += state.waitInc;
+            if(state.wait >= 1.0f){
+                // Holding period is over. Switch to new delay length and start fading it in
+                state.delayInSamples = state.targetDelay;
+                state.wait = 0.0f;
+                state.fadeTarget = 1.0f; // fade in
             }
-            
-            // Write the output samples back into the juce::AudioBuffer
-            outputDataL[sample] = outL;
-            outputDataR[sample] = outR;
-            
-            // Atmomically store the peaks (will be communicated to Editor)
-            maxL = std::max(maxL, std::abs(outL));
-            maxR = std::max(maxR, std::abs(outR));
-            
-            /*
-                Outputting values as if they were an audio signal and looking at them using the oscilloscope
-                is a simple trick to help debug the plug-in and verify everything works as it should.
-             */
-            //outputDataL[sample] = params.delayTime / 5000.0f;  // Checks to see how delay time smoothly
-            //outputDataR[sample] = params.delayTime/ 5000.0f;   // transitions
-            //outputDataL[sample] = fade;     // CHeck to see how delay Line fades
-            //outputDataR[sample] = fade;
         }
+    }
+    fadeRamp = { envelope, state.fade, false };
+}
+
+/*
+    One-pole glide of the delay time: targetDelay + glideDistance * glideDecay[n], n samples after the
+    start of the glide or the last grid point. Snaps to the target within 0.001 samples, at a grid point.
+ */
+void DelayAudioProcessor::glideDelay(float* delay, int numSamples) noexcept
+{
+    float target = state.targetDelay;
+    const float* decay = glideDecay.data() + state.glideOffset;
+    for(int i = 0; i < numSamples; ++i)
+        delay[i] = target + state.glideDistance * decay[i];
+    state.glideOffset += numSamples;
+    
+    bool onGrid = (controlPosition + numSamples) % maxChunkSize == 0;
+    bool arrived = onGrid && std::abs(state.glideDistance * decay[numSamples - 1]) < 0.001f;
+    state.delayInSamples = arrived ? target : delay[numSamples - 1];
+}
+
+/*
+    Equal-power gains for the old & new delay time. The two taps play different parts of the signal,
+    which add up like uncorrelated noise, so equal-power keeps the loudness steady where a linear
+    crossfade would dip by 3 dB halfway through.
+ */
+void DelayAudioProcessor::computeCrossfade(int numSamples) noexcept
+{
+    float* oldDelay = scratch.getWritePointer(oldDelayRow);
+    float* oldGain  = scratch.getWritePointer(oldGainRow);
+    float* newGain  = scratch.getWritePointer(newGainRow);
+    
+    juce::FloatVectorOperations::fill(oldDelay, state.oldDelay, numSamples);
+    
+    // xfade goes from 1 to 0, which is a pan from -1 (all old) to 1 (all new)
+    for(int i = 0; i < numSamples; ++i)
+        oldGain[i] = 1.0f - 2.0f * std::max(1.0f - state.xfadeStep * float(state.xfadeCount + i + 1), 0.0f);
+    panningEqualPowerFast(oldGain, oldGain, newGain, numSamples);
+    
+    state.xfadeCount += numSamples;
+    state.xfade = std::max(1.0f - state.xfadeStep * float(state.xfadeCount), 0.0f);
+    if(state.xfade == 0.0f)
+        state.oldDelay = 0.0f;  // done, the next chunk only reads the new delay time
+}
+
+/*
+    Stage 2a: the LFO pushes the read position back by up to Mod Depth. One LFO value per sample
+    for each lane comes from the wavetable, scaled by the depth & added to the delay rows.
+    With a stereo phase offset the right lane gets delay rows of its own.
+ */
+void DelayAudioProcessor::modulateDelays(int numSamples) noexcept
+{
+    const auto& modulation = params.modulation;
+    float frequency = modulation.sync ? float(1000.0 / tempo.getMillisecondsforNoteLength(modulation.note)) : modulation.rate;
+    float* lfoL = scratch.getWritePointer(modLRow);
+    float* lfoR = scratch.getWritePointer(modRRow);
+    if(controlPosition == 0)
+        lfo.sync();
+    lfo.process(lfoL, lfoR, frequency, LFO::Shape(modulation.shape), modulation.phase, numSamples);
+    
+    float samplesPerMs = float(getSampleRate()) / 1000.0f;
+    if(params.modDepthRamp.isConstant){
+        float depth = params.modDepthRamp.value * samplesPerMs;
+        for(int i = 0; i < numSamples; ++i){
+            lfoL[i] *= depth;
+            lfoR[i] *= depth;
+        }
+    }
+    else{
+        const float* depth = params.modDepthRamp.values;
+        for(int i = 0; i < numSamples; ++i){
+            lfoL[i] *= depth[i] * samplesPerMs;
+            lfoR[i] *= depth[i] * samplesPerMs;
+        }
+    }
+    
+    stereoModulation = modulation.phase != 0.0f;
+    auto modulate = [&](ScratchRow row, ScratchRow rightRow){
+        float* left = scratch.getWritePointer(row);
+        if(stereoModulation){
+            float* right = scratch.getWritePointer(rightRow);
+            for(int i = 0; i < numSamples; ++i)
+                right[i] = left[i] + lfoR[i];
+        }
+        for(int i = 0; i < numSamples; ++i)
+            left[i] += lfoL[i];
+    };
+    modulate(delayRow, delayRRow);
+    if(crossfading)
+        modulate(oldDelayRow, oldDelayRRow);
+}
+
+/*
+    Stage 2b: Wet sample: What we call processed signals.
+    Picks the kernel for the selected interpolation once per chunk, not once per sample.
+ */
+void DelayAudioProcessor::readDelayLines(int numSamples) noexcept
+{
+    bool modulating = params.modDepthRamp.value > 0.0f || !params.modDepthRamp.isConstant;
+    stereoModulation = false;
+    if(modulating)
+        modulateDelays(numSamples);
+    
+    // Tape & modulation: the read position keeps moving, which needs a smooth 4-point curve. Nearest is grainy,
+    // Linear gets duller as the fraction moves through the middle & the Allpass can't follow a moving delay.
+    int quality = params.snapshot.quality;
+    if((params.snapshot.timeChange == Parameters::tape || modulating) && quality != Interpolation::lagrange)
+        quality = Interpolation::hermite;
+    
+    switch(quality){
+        case Interpolation::nearest:{
+            Interpolation::Nearest<StereoSample> nearest;
+            readDelayLines(nearest, nearest, numSamples);
+            break;
+        }
+        case Interpolation::hermite:{
+            Interpolation::Hermite<StereoSample> hermite;
+            readDelayLines(hermite, hermite, numSamples);
+            break;
+        }
+        case Interpolation::lagrange:{
+            Interpolation::Lagrange<StereoSample> lagrange;
+            readDelayLines(lagrange, lagrange, numSamples);
+            break;
+        }
+        case Interpolation::allpass:
+            readDelayLines(allpass, oldAllpass, numSamples);
+            break;
+        default:{
+            Interpolation::Linear<StereoSample> linear;
+            readDelayLines(linear, linear, numSamples);
+            break;
+        }
+    }
+}
+
+// Sample i of the chunk reads as if the chunk's first i + 1 samples had already been written.
+// oldInterpolator reads the old delay time of a crossfade, it can be the same object if it has no state.
+template<typename Interpolator>
+void DelayAudioProcessor::readDelayLines(Interpolator& interpolator, Interpolator& oldInterpolator, int numSamples) noexcept
+{
+    const float* delay = scratch.getReadPointer(delayRow);
+    StereoSample* wet = stereoRow(wetRow);
+    
+    if(stereoModulation)
+        delayLine.readBlock(interpolator, wet, delay, scratch.getReadPointer(delayRRow), numSamples);
+    else
+        delayLine.readBlock(interpolator, wet, delay, numSamples);
+    
+    // Only while crossfading: a second read at the old delay time, mixed in with the equal-power gains
+    if(crossfading){
+        StereoSample* oldWet = stereoRow(oldWetRow);
+        const float* oldDelay = scratch.getReadPointer(oldDelayRow);
+        if(stereoModulation)
+            delayLine.readBlock(oldInterpolator, oldWet, oldDelay, scratch.getReadPointer(oldDelayRRow), numSamples);
+        else
+            delayLine.readBlock(oldInterpolator, oldWet, oldDelay, numSamples);
+        
+        const float* oldGain = scratch.getReadPointer(oldGainRow);
+        const float* newGain = scratch.getReadPointer(newGainRow);
+        for(int i = 0; i < numSamples; ++i)
+            wet[i] = wet[i] * newGain[i] + oldWet[i] * oldGain[i];
+    }
+    
+    /* Apply fade as envelope of wet signal.
+     Most of the time fade = 1, and nothing happens to delayed sound
+     However, when we're ducking, the wet signal is suppressed
+    */
+    if(!fadeRamp.isConstant){
+        for(int i = 0; i < numSamples; ++i)
+            wet[i] *= fadeRamp.values[i];
+    }
+    else if(fadeRamp.value != 1.0f){
+        for(int i = 0; i < numSamples; ++i)
+            wet[i] *= fadeRamp.value;
+    }
+}
+
+/*
+    Stage 2b: Reverse. Two Hann-windowed grains, half a grain apart, each play one grain length of the
+    delay line backwards, starting maxChunkSize back (the newest samples that are written for sure).
+    Each read is one contiguous span, so there's no interpolation. The grain length is the delay time
+    at the sample grain A starts, so turning the delay knob never cuts a grain short.
+ */
+void DelayAudioProcessor::readReverse(int numSamples) noexcept
+{
+    StereoSample* wet = stereoRow(wetRow);
+    StereoSample* grainA = stereoRow(reverseARow);
+    StereoSample* grainB = stereoRow(reverseBRow);
+    float* gainA = scratch.getWritePointer(grainGainARow);
+    float* gainB = scratch.getWritePointer(grainGainBRow);
+    const float* delay = scratch.getReadPointer(delayRow);
+    
+    bool starting = state.grainHalf == 0;
+    for(int i = 0; i < numSamples;){
+        // A grain that starts at sample i of the chunk reads from maxChunkSize before that sample backwards
+        if(state.grainPosition == 0){
+            // Grain B reads up to two grains back. At 48 kHz the buffer holds 2^22 samples, so a grain is at most
+            // about 43.7 s long (grainHalf 21.8 s): Reverse plays delay times above that in shorter grains
+            int longest = (delayLine.getBufferLength() - 2 * maxChunkSize) / 4;
+            state.grainHalf = std::clamp(int(delay[i] * 0.5f + 0.5f), 1, longest);
+            state.grainDelayA = maxChunkSize + 1 - 2 * i;
+            if(starting)  // grain B carries on as if it had started half a grain ago
+                state.grainDelayB = state.grainDelayA + 2 * state.grainHalf;
+            starting = false;
+        }
+        else if(state.grainPosition == state.grainHalf)
+            state.grainDelayB = maxChunkSize + 1 - 2 * i;
+        
+        // Up to where the next grain starts
+        int length = 2 * state.grainHalf;
+        int next = state.grainPosition < state.grainHalf ? state.grainHalf : length;
+        int span = std::min(numSamples - i, next - state.grainPosition);
+        delayLine.readReverse(grainA + i, state.grainDelayA + i, span);
+        delayLine.readReverse(grainB + i, state.grainDelayB + i, span);
+        
+        // Window phase x as a pan position: 4 * min(x, 1 - x) - 1 is -1 at the ends of grain A & 1 in its middle
+        float scale = 4.0f / float(length);
+        for(int j = 0; j < span; ++j){
+            int position = state.grainPosition + j;
+            gainA[i + j] = float(std::min(position, length - position)) * scale - 1.0f;
+        }
+        
+        state.grainPosition = state.grainPosition + span == length ? 0 : state.grainPosition + span;
+        i += span;
+    }
+    state.grainDelayA += 2 * numSamples;
+    state.grainDelayB += 2 * numSamples;
+    
+    panningEqualPowerFast(gainA, gainB, gainA, numSamples);  // cos goes to grain B, sin to grain A
+    
+    if(params.snapshot.reverse && state.reverseMix == 1.0f){
+        for(int i = 0; i < numSamples; ++i)
+            wet[i] = grainA[i] * (gainA[i] * gainA[i]) + grainB[i] * (gainB[i] * gainB[i]);
+    }
+    else{
+        // Switching Reverse on or off crossfades between the forward & reversed echoes
+        float step = params.snapshot.reverse ? state.xfadeInc : -state.xfadeInc;
+        for(int i = 0; i < numSamples; ++i){
+            state.reverseMix = std::clamp(state.reverseMix + step, 0.0f, 1.0f);
+            StereoSample reversed = grainA[i] * (gainA[i] * gainA[i]) + grainB[i] * (gainB[i] * gainB[i]);
+            wet[i] += (reversed - wet[i]) * state.reverseMix;
+        }
+        if(state.reverseMix == 0.0f){  // all forward again, the next time starts with fresh grains
+            state.grainHalf = 0;
+            state.grainPosition = 0;
+        }
+    }
+}
+
+/*
+    Stage 3: apply the feedback gain, low/high-cut filters, saturator & diffuser to get the new feedback samples.
+ */
+void DelayAudioProcessor::applyFeedbackFilters(int numSamples) noexcept
+{
+    const StereoSample* wet = stereoRow(wetRow);
+    StereoSample* newFeedback = stereoRow(feedbackOutRow);
+    
+    if(params.feedbackRamp.isConstant){
+        float feedback = params.feedbackRamp.value;
+        for(int i = 0; i < numSamples; ++i)
+            newFeedback[i] = wet[i] * feedback;
+    }
+    else{
+        const float* feedback = params.feedbackRamp.values;
+        for(int i = 0; i < numSamples; ++i)
+            newFeedback[i] = wet[i] * feedback[i];
+    }
+    
+    // Control-rate cutoffs, filters at their neutral setting are skipped
+    feedbackFilters.process(newFeedback, params.lowCutRamp, params.highCutRamp, numSamples);
+    saturator.process(newFeedback, params.driveRamp, numSamples);     // nothing to do at 0% Drive
+    diffuser.process(newFeedback, params.diffusionRamp, numSamples);  // nothing to do at 0% Diffusion
+}
+
+/*
+    Stage 4: Multi-tap. The extra taps only go to the output, the feedback already has the wet signal.
+    The tap table is rebuilt every chunk, which is a few operations per tap. A tap whose time changes
+    fades out over one chunk & comes back in at its new time over the next, so it doesn't click.
+    With Taps at 0 & the last taps faded out, this costs nothing.
+ */
+void DelayAudioProcessor::addTaps(int numSamples) noexcept
+{
+    const auto& settings = params.taps;
+    if(settings.count == 0 && taps.longest == 0)
+        return;
+    
+    float samplesPerMs = float(getSampleRate()) / 1000.0f;
+    float previousTime = 0.0f;
+    taps.numActive = 0;
+    taps.longest = 0;
+    for(size_t tap = 0; tap < Parameters::maxTaps; ++tap){
+        float time = params.snapshot.tempoSync ? float(tempo.getMillisecondsforNoteLength(settings.note[tap]))
+                                               : settings.time[tap];
+        
+        // Swing: taps 1, 3, 5 & 7 move towards the tap after them, by up to a third of the distance to the one before
+        float swungTime = time;
+        if(tap % 2 == 0 && time > previousTime)
+            swungTime += settings.swing * (time - previousTime) * (1.0f / 3.0f);
+        previousTime = time;
+        swungTime = std::clamp(swungTime, Parameters::minDelayTime, Parameters::maxDelayTime);
+        int delay = int(swungTime * samplesPerMs + 0.5f);
+        
+        StereoSample start = taps.gain[tap];
+        StereoSample end = int(tap) < settings.count ? StereoSample{ settings.gainL[tap], settings.gainR[tap] } : StereoSample();
+        bool wasSilent = start.left == 0.0f && start.right == 0.0f;
+        if(wasSilent)
+            taps.delay[tap] = delay;  // nobody hears it yet, so it can jump
+        else if(delay != taps.delay[tap])
+            end = StereoSample();     // fade out at the old time first
+        taps.gain[tap] = end;
         
-        levelL.updateIfGreater(maxL);
-        levelR.updateIfGreater(maxR);
+        if(wasSilent && end.left == 0.0f && end.right == 0.0f)
+            continue;
+        int active = taps.numActive++;
+        taps.activeDelay[size_t(active)] = taps.delay[tap];
+        taps.startGain[size_t(active)] = start;
+        taps.endGain[size_t(active)] = end;
+        taps.longest = std::max(taps.longest, taps.delay[tap]);
+    }
+    
+    if(taps.numActive > 0)
+        delayLine.addTaps(stereoRow(wetRow), taps.activeDelay.data(), taps.startGain.data(), taps.endGain.data(),
+                          taps.numActive, numSamples);
+}
+
+/*
+    Stage 5: Add the sample coming from the feedback path to the dry signal, and put sum in delay line.
+    Ping-Poing feedback: Notice we are feedback R to the left channels delay line.
+    Sample i uses the feedback of sample i - 1, the last one is carried over to the next chunk.
+ */
+void DelayAudioProcessor::writeDelayLines(int numSamples) noexcept
+{
+    const float* mono = scratch.getReadPointer(monoRow);
+    const float* panL = rampValues(params.panLRamp, panLRow, numSamples);
+    const float* panR = rampValues(params.panRRamp, panRRow, numSamples);
+    const StereoSample* newFeedback = stereoRow(feedbackOutRow);
+    
+    // Swapping the lanes sends the feedback of R to L & the feedback of L to R
+    StereoSample* input = stereoRow(delayInputRow);
+    input[0] = StereoSample{ mono[0] * panL[0], mono[0] * panR[0] } + state.feedback.swapped();
+    for(int i = 1; i < numSamples; ++i)
+        input[i] = StereoSample{ mono[i] * panL[i], mono[i] * panR[i] } + newFeedback[i - 1].swapped();
+    
+    // Freeze just went off, the writes fade in after the faded end of the loop (see stopLoop())
+    if(state.resumeFade > 0){
+        int count = std::min(numSamples, state.resumeFade);
+        float step = 1.0f / float(state.loopFade);
+        for(int i = 0; i < count; ++i)
+            input[i] *= 1.0f - float(state.resumeFade - i) * step;
+        state.resumeFade -= count;
+    }
+    
+    delayLine.writeBlock(input, numSamples);
+    
+    state.feedback = newFeedback[numSamples - 1];
+    
+    // Count how long everything going into the delay line has been below the silence threshold
+    float peak = 0.0f;
+    for(int i = 0; i < numSamples; ++i)
+        peak = std::max({ peak, std::abs(input[i].left), std::abs(input[i].right) });
+    state.quietSamples = peak < silenceThreshold ? std::min(state.quietSamples + numSamples, 1 << 30) : 0;
+}
+
+/*
+    Freeze: the delay line becomes a looper. Nothing is written & the newest loopLength samples (the delay
+    time, rounded) are read straight out of it, so going into Freeze carries on from where the delay was.
+    Towards its end the loop crossfades into the samples just before it, so the jump back doesn't click.
+ */
+void DelayAudioProcessor::readLoop(int numSamples) noexcept
+{
+    if(state.loopLength == 0){
+        state.loopLength = int(state.delayInSamples + 0.5f);
+        state.loopPosition = 0;
+        state.loopFade = std::min(int(loopFadeTime * float(getSampleRate())), state.loopLength / 2);
+    }
+    
+    StereoSample* wet = stereoRow(wetRow);
+    StereoSample* before = stereoRow(oldWetRow);
+    int length = state.loopLength;
+    int fadeStart = length - state.loopFade;
+    float fadeStep = 1.0f / float(std::max(state.loopFade, 1));
+    
+    for(int i = 0; i < numSamples;){
+        int position = state.loopPosition;
+        int span = std::min(numSamples - i, length - position);
+        delayLine.readSpan(wet + i, length - position, span);
         
-        #if JUCE_DEBUG
-        protectYourEars(buffer);  // Techniacally not allowed in audio thread (its slow w system calls)
-                                  // However statement prints something in an exceptional situation, so it OK
-        #endif
-    }
-    else { // Processing loop for mono
-        for(int sample = 0; sample < buffer.getNumSamples(); ++sample){
-            params.smoothen();
-            
-            float delayInSamples = params.delayTime / 1000.0f * sampleRate;
-            
-            float dry = inputDataL[sample];
-            delayLineL.write(dry + feedbackL);
-            
-            float wet = delayLineL.read(delayInSamples);
-            feedbackL = wet * params.feedback;
-            
-            float mix = dry + wet*params.mix;
-            outputDataL[sample] = mix * params.gain;
+        // The part of the span that's in the crossfade, the samples before the loop are one loop length further back
+        int fadeFrom = std::max(position, fadeStart);
+        int fadeCount = position + span - fadeFrom;
+        if(fadeCount > 0){
+            StereoSample* output = wet + i + (fadeFrom - position);
+            delayLine.readSpan(before, 2 * length - fadeFrom, fadeCount);
+            for(int j = 0; j < fadeCount; ++j){
+                float fade = float(fadeFrom - fadeStart + j + 1) * fadeStep;
+                output[j] += (before[j] - output[j]) * fade;
+            }
         }
+        
+        i += span;
+        state.loopPosition = position + span == length ? 0 : position + span;
     }
 }
+
+/*
+    Once writing starts again the rest of the loop fades out like the old delay time of a crossfade,
+    & is over before the new writes reach it (processChunk() plays the loop on until a crossfade is left).
+    The end of the loop & the first new writes are both faded, the input while frozen was never recorded.
+ */
+void DelayAudioProcessor::stopLoop() noexcept
+{
+    int loopLeft = state.loopLength - state.loopPosition;
+    state.oldDelay = float(loopLeft);
+    state.xfade = 1.0f;
+    state.xfadeStep = std::max(state.xfadeInc, 1.0f / float(loopLeft));
+    state.xfadeCount = 0;
+    oldAllpass.reset();
     
+    delayLine.fadeOut(state.loopFade);
+    state.resumeFade = state.loopFade;
+    state.loopLength = 0;
+}
+
+/*
+    The tail is over after enough repeats to fall below the silence threshold:
+        feedback^repeats = silenceThreshold  ->  repeats = log(silenceThreshold) / log(feedback)
+    Drive makes quiet repeats up to 3 dB louder, so it counts as more feedback. Each repeat can come out
+    later than the delay time: up to twice it with Reverse, plus Mod Depth & the diffuser's longest path.
+    The taps add tapTime after the last repeat. Freeze (or a loop playing out) makes the tail infinite.
+ */
+void DelayAudioProcessor::updateTailLength(float delayTime, float feedback, float tapTime) noexcept
+{
+    double tail = std::numeric_limits<double>::infinity();
+    feedback *= Saturator::quietGain(std::max(params.snapshot.drive, params.driveRamp.value));
+    bool frozen = params.snapshot.freeze || state.loopLength > 0;
+    if(feedback < 1.0f && !frozen){
+        bool reverse = params.snapshot.reverse || state.reverseMix > 0.0f;
+        bool diffuse = params.snapshot.diffusion > 0.0f;
+        double repeatTime = (reverse ? 2.0 : 1.0) * delayTime / 1000.0 + params.modulation.depth / 1000.0
+                          + (diffuse ? Diffuser::getLongestPathSeconds() : 0.0);
+        double repeats = feedback > 0.0f ? std::log(double(silenceThreshold)) / std::log(double(feedback)) : 0.0;
+        tail = repeatTime * (1.0 + std::ceil(repeats)) + tapTime / 1000.0
+             + (diffuse ? Diffuser::getTailSeconds(silenceThreshold) : 0.0);
+    }
+    if(tailLengthSeconds.exchange(tail) != tail)
+        triggerAsyncUpdate();  // several changes before the message thread gets to it are one update
+}
+
+void DelayAudioProcessor::handleAsyncUpdate()
+{
+    updateHostDisplay(ChangeDetails().withTailLengthChanged(true));
+}
+
+/*
+    Leaves the idle state. Everything in the delay line & filters is below the silence threshold,
+    so nothing is audible if the smoothers & ducking jump straight to the current settings.
+ */
+void DelayAudioProcessor::wakeUp() noexcept
+{
+    idle = false;
+    params.reset();
+    state.delayInSamples = 0.0f;  // takes the new delay time right away, without ducking
+    state.targetDelay = 0.0f;
+    state.fade = 1.0f;
+    state.fadeTarget = 1.0f;
+    state.wait = 0.0f;
+    state.oldDelay = 0.0f;
+    state.xfade = 0.0f;
+    state.glideOffset = -1;
+    state.loopLength = 0;
+    state.resumeFade = 0;
+    state.reverseMix = params.snapshot.reverse ? 1.0f : 0.0f;
+    state.reversed = params.snapshot.reverse;
+    state.grainHalf = 0;
+    state.grainPosition = 0;
+    state.feedback = StereoSample();
+    state.quietSamples = 0;
+    taps = Taps();
+    lfo.reset();
+    feedbackFilters.reset();
+    saturator.reset();
+    diffuser.reset();
+    allpass.reset();
+    oldAllpass.reset();
+}
 
 //==============================================================================
 bool DelayAudioProcessor::hasEditor() const
 {
-    return true; // (change this to false if you choose to not supply an editor)
+    return !DELAY_HEADLESS; // the command-line tools have no editor
 }
 
 // DAW
 juce::AudioProcessorEditor* DelayAudioProcessor::createEditor()
 {
+   #if DELAY_HEADLESS
+    return nullptr;
+   #else
     return new DelayAudioProcessorEditor (*this);
+   #endif
 }
 
 //==============================================================================
@@ -386,7 +1085,9 @@ void DelayAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
     // You should use this method to store your parameters in the memory block.
     // You could do that either as raw data, or use the XML or ValueTree classes
     // as intermediaries to make it easy to save and load complex data.
-    copyXmlToBinary(*apvts.copyState().createXml(), destData);
+    auto savedState = apvts.copyState();
+    savedState.setProperty("version", stateVersion, nullptr);
+    copyXmlToBinary(*savedState.createXml(), destData);
     //DBG(apvts.copyState().toXmlString());
 }
 
@@ -399,6 +1100,9 @@ void DelayAudioProcessor::setStateInformation (const void* data, int sizeInBytes
     // whose contents will have been created by the getStateInformation() call.
     std::unique_ptr<juce::XmlElement> xml(getXmlFromBinary(data, sizeInBytes));
     if(xml.get() != nullptr && xml->hasTagName(apvts.state.getType())){
+        // The state holds plain values (milliseconds for the delay time), so a version 1 state (no "version"
+        // property) loads the same times into the 60 second range & needs no conversion. Host automation doesn't
+        // go through here: it sends normalized values, which map to different times since version 2.
         apvts.replaceState(juce::ValueTree::fromXml(*xml));
     }
 }
@@ -13,12 +13,16 @@
 #include "Tempo.h"
 #include "DelayLine.h"
 #include "Measurement.h"
+#include "FeedbackFilters.h"
+#include "LFO.h"
+#include "Diffuser.h"
+#include "Saturator.h"
 
 
 //==============================================================================
 /**
 */
-class DelayAudioProcessor  : public juce::AudioProcessor
+class DelayAudioProcessor  : public juce::AudioProcessor, private juce::AsyncUpdater
 {
 public:
     //==============================================================================
@@ -86,35 +90,183 @@ private:
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DelayAudioProcessor)
     
+    /*        Staged block processing
+       A block is cut into chunks & every stage runs over a whole chunk before the next one starts.
+     */
+    template<int numInputChannels, int numOutputChannels>
+    int processChunks(const float* inputL, const float* inputR, float* outputL, float* outputR,
+                      int numSamples, float syncedTime, float& maxL, float& maxR) noexcept;
+    template<int numInputChannels, int numOutputChannels>
+    void processChunk(const float* inputL, const float* inputR, float* outputL, float* outputR,
+                      int numSamples, float syncedTime, float& maxL, float& maxR) noexcept;
+    float syncedDelayTime() const noexcept;                           // delay time for Tempo Sync, in ms
+    void passThrough(juce::AudioBuffer<float>& output, int startSample, int numSamples, bool monoToStereo) noexcept;  // bypassed
+    void computeRamps(int numSamples, float syncedTime) noexcept;   // smoothed params, delay & ducking
+    void computeCrossfade(int numSamples) noexcept;                   // gains of the old & new delay time
+    void glideDelay(float* delay, int numSamples) noexcept;           // tape-style delay time glide
+    void modulateDelays(int numSamples) noexcept;                     // LFO on the delay time
+    void readDelayLines(int numSamples) noexcept;                     // interpolated wet signal
+    template<typename Interpolator>
+    void readDelayLines(Interpolator& interpolator, Interpolator& oldInterpolator, int numSamples) noexcept;
+    void readReverse(int numSamples) noexcept;                        // reversed grains, crossfaded with the above
+    void applyFeedbackFilters(int numSamples) noexcept;               // feedback gain + low/high-cut + drive + diffusion
+    void addTaps(int numSamples) noexcept;                            // extra taps of the multi-tap
+    void writeDelayLines(int numSamples) noexcept;                    // input + ping-pong feedback
+    void readLoop(int numSamples) noexcept;                           // Freeze: replaces all of the above
+    void stopLoop() noexcept;                                         // Freeze is off, back to the delay
+    
+    // Rows of the scratch buffer, every row holds one value per sample of the current chunk
+    enum ScratchRow { gainRow, mixRow, feedbackRow, panLRow, panRRow, delayRow, fadeRow, monoRow,
+                      oldDelayRow, oldGainRow, newGainRow, delayRRow, oldDelayRRow, modLRow, modRRow,
+                      grainGainARow, grainGainBRow, numScratchRows };
+    juce::AudioBuffer<float> scratch;
+    
+    // Rows of interleaved left/right samples, for the signals that go through the stereo engine
+    enum StereoRow { dryRow, wetRow, oldWetRow, feedbackOutRow, delayInputRow, reverseARow, reverseBRow, numStereoRows };
+    std::vector<StereoSample> stereoScratch;
+    
+    StereoSample* stereoRow(StereoRow row) noexcept{
+        return stereoScratch.data() + size_t(row * maxChunkSize);
+    }
+    
+    /** Writes one sample of the stereo engine to the output bus, folded down to mono for a mono output. */
+    template<int numOutputChannels>
+    static void writeOutput(float* outputL, float* outputR, int i, StereoSample sample) noexcept{
+        if constexpr (numOutputChannels == 2){
+            outputL[i] = sample.left;
+            outputR[i] = sample.right;
+        }
+        else
+            outputL[i] = (sample.left + sample.right) * 0.5f;
+    }
+    
+    /** Returns one value per sample for a ramp. A constant ramp is first written into the given row. */
+    const float* rampValues(const Parameters::Ramp& ramp, ScratchRow row, int numSamples) noexcept;
+    
+    Parameters::Ramp fadeRamp;  // ducking envelope of the current chunk
+    bool crossfading = false;   // the current chunk also reads the old delay time, see computeCrossfade()
+    bool stereoModulation = false;  // left & right read at different delay times in the current chunk
+    
+    // Longest chunk the stages may process at once. A chunk can never be longer than the shortest
+    // delay (minus the newer interpolation points), since all of its taps are read before its input
+    // is written into the delay lines.
+    int maxChunkSize = 0;
+    
+    // Control grid: every maxChunkSize samples of the stream, counted from prepareToPlay() & through bypassed or
+    // idle blocks. The chunks end on it & the parameters are read on it, so the output doesn't depend on where the
+    // host's blocks start. controlInterval is the spacing when the shortest delay allows it.
+    static constexpr int controlInterval = 32;
+    int controlPosition = 0;  // samples since the last grid point
+    bool dspBypassed = false; // Bypass has faded to dry, the DSP doesn't run
+    
     Tempo tempo;
     
     // DelayLine: Delay sound by a certain amount of time. We keep track of samples
     // in Juce's own Circular buffer. A chunk of memory that stores samples
     // & waits for the right moment to start outputting them
     //juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::Linear> delayLine;
-    DelayLine delayLineL, delayLineR;
-    float delayInSamples = 0.0f;   // current delay time
-    float targetDelay    = 0.0f;
-    
-    /* For Ducking feedback */
-    float fade           = 0.0f;   // Current wet signal envelope level
-    float fadeTarget     = 0.0f;
-    float coeff          = 0.0f;
-    float wait           = 0.0f;
-    float waitInc        = 0.0f;
-    //float xfade          = 0.0f;   // Cross-fade to remove delay time knob artifacts
-    //float xfadeInc       = 0.0f;   // step size of xfade, determined by sample rate
-    
-    
-    // Stereo Feedback state
-    float feedbackL = 0.0f;
-    float feedbackR = 0.0f;
-    
-    // SVF from JUCE
-    juce::dsp::StateVariableTPTFilter<float> lowCutFilter;
-    juce::dsp::StateVariableTPTFilter<float> highCutFilter;
-    
-    // Previous param state
-    float lastLowCut = -1.0f;
-    float lastHighCut = -1.0f;   // "no cutoff frequency set yet"
+    DelayLine<StereoSample, DelayStorage::Default> delayLine;  // left & right interleaved, storage set by DELAY_STORAGE
+    
+    // Samples the delay line keeps beyond the current delay time, so turning the delay up
+    // still finds audio to play. Older pages go back to the pool. Five seconds was the longest
+    // delay before the delay line was paged, so nothing shorter than that sounds any different.
+    static constexpr double historyTime = 5.0;  // in seconds
+    int historySamples = 0;
+    Interpolation::Allpass<StereoSample> allpass;    // the only interpolation with state of its own
+    Interpolation::Allpass<StereoSample> oldAllpass; // so the tap that fades out in a crossfade needs its own
+    
+    /* Multi-tap: the extra taps, one array per setting so DelayLine::addTaps() can loop over them */
+    struct Taps
+    {
+        std::array<int, Parameters::maxTaps> delay{};          // where each tap reads, in samples
+        std::array<StereoSample, Parameters::maxTaps> gain{};  // its gain at the end of the last chunk
+        
+        // The taps that are heard in the current chunk, packed together
+        std::array<int, Parameters::maxTaps> activeDelay{};
+        std::array<StereoSample, Parameters::maxTaps> startGain{}, endGain{};
+        int numActive = 0;
+        int longest = 0;  // longest delay of the taps that are heard, in samples
+    };
+    Taps taps;
+    
+    LFO lfo;  // modulates the delay time
+    
+    /* State that every chunk reads & writes, kept together on one cache line */
+    struct alignas(64) EngineState
+    {
+        StereoSample feedback;         // Stereo Feedback state, carried over to the next chunk
+        
+        float delayInSamples = 0.0f;   // current delay time
+        float targetDelay    = 0.0f;
+        
+        /* For Ducking feedback */
+        float fade           = 0.0f;   // Current wet signal envelope level
+        float fadeTarget     = 0.0f;
+        float coeff          = 0.0f;
+        float wait           = 0.0f;
+        float waitInc        = 0.0f;
+        int   quietSamples   = 0;      // how long the delay line input has been below silenceThreshold
+        
+        /* Bypass crossfade: 0 is fully processed, 1 is fully dry */
+        float bypassMix      = 0.0f;
+        float bypassInc      = 0.0f;
+        
+        /* Time Change = Crossfade: both delay times are read while the old one fades out */
+        float oldDelay       = 0.0f;   // delay time that is fading out, 0 when there is none
+        float xfade          = 0.0f;   // Cross-fade to remove delay time knob artifacts. Level of the old delay, 1 -> 0
+        float xfadeInc       = 0.0f;   // step size of xfade, determined by sample rate
+        float xfadeStep      = 0.0f;   // step of the running crossfade: xfadeInc, or faster after a loop (see stopLoop())
+        int   xfadeCount     = 0;      // samples since the crossfade started
+        
+        /* Time Change = Tape: where the glide was at its start or the last grid point */
+        float glideDistance  = 0.0f;   // delayInSamples - targetDelay back then
+        int   glideOffset    = -1;     // samples since then, -1 when not gliding
+        
+        /* Freeze: the newest loopLength samples of the delay line play over & over */
+        int   loopLength     = 0;      // 0 when not frozen
+        int   loopPosition   = 0;      // sample of the loop that plays next
+        int   loopFade       = 0;      // the last loopFade samples of the loop crossfade into its start
+        int   resumeFade     = 0;      // writes that still fade in after Freeze went off
+        
+        /* Reverse: two grains half a grain apart, each reads one grain length of the delay line backwards */
+        float reverseMix     = 0.0f;   // 0 is the forward delay, 1 is reversed. Crossfades like a Time Change
+        bool  reversed       = false;  // all the way reversed, so the forward read is skipped. Set on the control grid
+        int   grainHalf      = 0;      // half the grain length in samples, 0 until the first grain starts
+        int   grainPosition  = 0;      // where grain A is, 0 - 2 * grainHalf. Grain B is half a grain further
+        int   grainDelayA    = 0;      // delay of each grain's sample at the start of the chunk, see readReverse()
+        int   grainDelayB    = 0;
+    };
+    EngineState state;
+    
+    // Low-cut & high-cut SVFs in the feedback path
+    FeedbackFilters feedbackFilters;
+    
+    // Saturation & allpass diffusion in the feedback path, after the filters
+    Saturator saturator;
+    Diffuser diffuser;
+    
+    /* Tail & idle state. Anything below silenceThreshold (-100 dB) counts as silence */
+    static constexpr float silenceThreshold = 1.0e-5f;
+    void updateTailLength(float delayTime, float feedback, float tapTime) noexcept;
+    void handleAsyncUpdate() override;  // tells the host the tail changed, on the message thread
+    void wakeUp() noexcept;
+    std::atomic<double> tailLengthSeconds { 0.0 };  // read by the host from another thread
+    bool idle = false;      // silent input & decayed tail, processBlock skips the DSP
+    
+    /* Bypass fades to dry over bypassFadeTime, after that processBlock skips the DSP until bypass is off again */
+    static constexpr float bypassFadeTime = 0.02f;  // in seconds
+    
+    /* Length of the crossfade to a new delay time. Short enough to follow automation, long enough not to click */
+    static constexpr float crossfadeTime = 0.05f;   // in seconds
+    
+    /* Time Change = Tape: one-pole glide to a new delay time. After glideTime it has gone 63.2% of the way */
+    static constexpr float glideTime = 0.2f;        // in seconds
+    std::vector<float> glideDecay;                  // how much of the distance is left after sample i
+    
+    /* Freeze: crossfade at the end of the loop, so the jump back to its start doesn't click */
+    static constexpr float loopFadeTime = 0.01f;    // in seconds
+    
+    /* Written into the saved state. 1 (or missing) is a state from when the delay time went up to 5 seconds,
+       2 is the 60 second range with the knob centred at 320 ms */
+    static constexpr int stateVersion = 2;
 };
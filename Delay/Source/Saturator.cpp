@@ -0,0 +1,51 @@
+/*
+  ==============================================================================
+
+    Saturator.cpp
+
+  ==============================================================================
+*/
+
+#include "Saturator.h"
+
+void Saturator::reset() noexcept
+{
+    active = false;
+}
+
+void Saturator::process(StereoSample* samples, const Parameters::Ramp& drive, int numSamples) noexcept
+{
+    bool useSaturator = !(drive.isConstant && drive.value == 0.0f);
+    if(!useSaturator)
+        active = false;
+    if(!useSaturator || numSamples == 0)
+        return;
+    
+    // F(g * x): with the gain g in front of the curve & 1 / g after it, y = 2 * x1 / (F(g * x1) + F(g * x0))
+    auto antiderivative = [](StereoSample x, float gain) noexcept {
+        StereoSample gx = x * gain;
+        return StereoSample{ std::sqrt(1.0f + gx.left * gx.left), std::sqrt(1.0f + gx.right * gx.right) };
+    };
+    
+    // Starting from the current sample, so switching on doesn't click
+    if(!active){
+        float gain = (drive.isConstant ? drive.value : drive.values[0]) * maxDrive;
+        previousAntiderivative = antiderivative(samples[0], gain);
+        active = true;
+    }
+    
+    float constantMakeup = drive.isConstant ? 2.0f * quietGain(drive.value) : 0.0f;
+    StereoSample F0 = previousAntiderivative;
+    for(int i = 0; i < numSamples; ++i){
+        float gain = (drive.isConstant ? drive.value : drive.values[i]) * maxDrive;
+        float makeup = drive.isConstant ? constantMakeup : 2.0f * quietGain(drive.values[i]);
+        StereoSample x1 = samples[i];
+        StereoSample F1 = antiderivative(x1, gain);
+        
+        // The average gain of the curve between x0 & x1, on x1
+        StereoSample norm = F1 + F0;
+        samples[i] = StereoSample{ x1.left / norm.left, x1.right / norm.right } * makeup;
+        F0 = F1;
+    }
+    previousAntiderivative = F0;
+}
@@ -0,0 +1,46 @@
+/*
+  ==============================================================================
+
+    Saturator.h
+
+    Soft saturation in the feedback path: warmer repeats, & loud feedback settles into a stable
+    self-oscillation instead of running away. The curve is f(x) = x / sqrt(1 + x^2). First-order
+    ADAA with F(x) = sqrt(1 + x^2) is a gain of 2 / (F(x1) + F(x0)) on (x1 + x0) / 2, a half-sample
+    lowpass the feedback would apply on every repeat, so the gain goes on x1 instead.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Parameters.h"
+#include "StereoSample.h"
+
+class Saturator
+{
+public:
+    /** Forgets the previous sample, e.g. when playback restarts */
+    void reset() noexcept;
+
+    /**
+        Saturates the feedback in place. drive is the Drive parameter, 0 - 1. The makeup gain after the
+        curve brings a peak of makeupLevel back to where it was, so 100% Drive squashes the loudest repeats
+        to -9 dB instead of -12 dB. At 0 for a whole chunk this does nothing at all.
+     */
+    void process(StereoSample* samples, const Parameters::Ramp& drive, int numSamples) noexcept;
+
+    /** How much louder quiet signals come out, 1 at 0% Drive up to sqrt(2) (+3 dB) at 100% */
+    static float quietGain(float drive) noexcept
+    {
+        float level = drive * maxDrive * makeupLevel;
+        return std::sqrt(1.0f + level * level);
+    }
+
+private:
+    static constexpr float maxDrive = 4.0f;      // +12 dB into the curve at 100% Drive
+    static constexpr float makeupLevel = 0.25f;  // -12 dB peaks come out as they went in, at any Drive
+
+    StereoSample previousAntiderivative;
+    bool active = false;
+};
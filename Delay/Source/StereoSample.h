@@ -0,0 +1,33 @@
+/*
+  ==============================================================================
+
+    StereoSample.h
+    A left & right sample that travel together through the stereo engine.
+
+    Both channels always do the same work, so they sit side by side (L R L R ...) & every operation
+    below works on both lanes at once. 8 bytes & 8-byte aligned: half of one SSE/NEON register.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+struct alignas(8) StereoSample
+{
+    float left = 0.0f;
+    float right = 0.0f;
+
+    /** Exchanges the two lanes. Used for the ping-pong cross-feed: R feeds L & L feeds R. */
+    StereoSample swapped() const noexcept { return { right, left }; }
+
+    StereoSample& operator+=(StereoSample other) noexcept { left += other.left; right += other.right; return *this; }
+    StereoSample& operator-=(StereoSample other) noexcept { left -= other.left; right -= other.right; return *this; }
+    StereoSample& operator*=(StereoSample other) noexcept { left *= other.left; right *= other.right; return *this; }
+    StereoSample& operator*=(float gain) noexcept { left *= gain; right *= gain; return *this; }
+};
+
+inline StereoSample operator+(StereoSample a, StereoSample b) noexcept { return { a.left + b.left, a.right + b.right }; }
+inline StereoSample operator-(StereoSample a, StereoSample b) noexcept { return { a.left - b.left, a.right - b.right }; }
+inline StereoSample operator*(StereoSample a, StereoSample b) noexcept { return { a.left * b.left, a.right * b.right }; }
+inline StereoSample operator*(StereoSample a, float gain) noexcept { return { a.left * gain, a.right * gain }; }
+inline StereoSample operator*(float gain, StereoSample a) noexcept { return { gain * a.left, gain * a.right }; }
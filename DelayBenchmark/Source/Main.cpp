@@ -0,0 +1,540 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    DelayBenchmark: times DelayAudioProcessor::processBlock over a matrix of
+    sample rates, block sizes, bus layouts & parameter scenarios.
+
+    Every scenario gets a fresh processor & a warm-up, then every processBlock call is timed on its own.
+    The read/... scenarios time DelayLine::readBlock alone for each interpolation policy. Reports ns/sample
+    & cycles/sample, & can be compared against a JSON baseline so a change that costs CPU fails the run.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <iostream>
+#include <iomanip>
+#include "../../Delay/Source/PluginProcessor.h"
+
+#if JUCE_INTEL
+ #if JUCE_MSVC
+  #include <intrin.h>
+ #else
+  #include <x86intrin.h>
+ #endif
+#endif
+
+//==============================================================================
+/** What the parameters are set to & how they move while a scenario runs */
+enum class Automation { none, delayTime, filterSweep, tempoSync, bypass,
+                        qualityNearest, qualityHermite, qualityLagrange, qualityAllpass,
+                        crossfade, tape, taps, modulation, drive, diffusion, freeze, reverse };
+
+static const char* automationNames[] = { "static", "delay-automation", "filter-sweep", "tempo-sync", "bypass",
+                                         "quality-nearest", "quality-hermite", "quality-lagrange", "quality-allpass",
+                                         "crossfade-automation", "tape-automation", "taps", "modulation", "drive",
+                                         "diffusion", "freeze", "reverse" };
+
+static const char* interpolationNames[] = { "nearest", "linear", "hermite", "lagrange", "allpass" };
+
+struct Layout
+{
+    const char* name;
+    int numInputs, numOutputs;
+};
+
+static const Layout layouts[] = { { "mono", 1, 1 }, { "mono-stereo", 1, 2 }, { "stereo", 2, 2 } };
+
+struct Scenario
+{
+    juce::String name;
+    double sampleRate;
+    int blockSize;
+    Layout layout;
+    Automation automation;
+    int interpolation = -1;  // read/... scenarios: the policy (Interpolation::Type) that DelayLine::readBlock is timed with
+};
+
+struct ScenarioResult
+{
+    juce::String name;
+    double meanNs = 0.0, medianNs = 0.0, p95Ns = 0.0, p99Ns = 0.0;  // per sample
+    double cyclesPerSample = -1.0;                                  // -1: no cycle counter
+};
+
+/** Everything that was set on the command line */
+struct BenchmarkSettings
+{
+    juce::Array<double> sampleRates { 44100.0, 48000.0, 96000.0, 192000.0 };
+    juce::Array<int> blockSizes { 16, 64, 256, 1024, 4096 };
+    juce::StringArray filters;  // only run scenarios whose name contains one of these
+    double seconds = 2.0;       // audio processed per scenario (after the warm-up)
+    juce::File jsonOutput;
+    juce::File baseline;
+    double tolerance = 10.0;    // % slower than the baseline before a scenario counts as a regression
+};
+
+/** Same tempo for every block, there's no host */
+class FixedTempoPlayHead : public juce::AudioPlayHead
+{
+public:
+    juce::Optional<PositionInfo> getPosition() const override
+    {
+        PositionInfo info;
+        info.setBpm(120.0);
+        info.setIsPlaying(true);
+        return info;
+    }
+};
+
+//==============================================================================
+/** Time stamp counter. Counts at a fixed reference rate, close to the nominal clock of the CPU. */
+#if JUCE_INTEL
+static constexpr bool hasCycleCounter = true;
+static inline juce::uint64 readCycleCounter() noexcept { return juce::uint64(__rdtsc()); }
+#else
+static constexpr bool hasCycleCounter = false;
+static inline juce::uint64 readCycleCounter() noexcept { return 0; }
+#endif
+
+static void setParameter(DelayAudioProcessor& processor, const juce::ParameterID& id, float value)
+{
+    auto* param = processor.apvts.getParameter(id.getParamID());
+    jassert(param != nullptr);
+    param->setValueNotifyingHost(param->convertTo0to1(value));
+}
+
+/** Moves the parameters of the scenario, called before every block */
+static void automate(DelayAudioProcessor& processor, Automation automation, int blockIndex)
+{
+    // A slow triangle, from 0 to 1 & back in 256 blocks
+    float phase = float(blockIndex % 256) / 128.0f;
+    float triangle = phase < 1.0f ? phase : 2.0f - phase;
+
+    switch(automation){
+        case Automation::delayTime:
+        case Automation::crossfade:
+        case Automation::tape:
+            // New delay time every 64 blocks, each one starts a duck & fade-in, a crossfade or a glide
+            if(blockIndex % 64 == 0)
+                setParameter(processor, delayTimeID, 100.0f + 400.0f * triangle);
+            break;
+        case Automation::filterSweep:
+            setParameter(processor, lowCutParamID, 20.0f + 1980.0f * triangle);
+            setParameter(processor, highCutParamID, 20000.0f - 18000.0f * triangle);
+            break;
+        default:
+            break;
+    }
+}
+
+/** Sets the parameters the scenario starts with, on top of the ones every scenario uses */
+static void setUp(DelayAudioProcessor& processor, Automation automation)
+{
+    switch(automation){
+        case Automation::tempoSync:
+            setParameter(processor, tempoSyncParamID, 1.0f);
+            break;
+        case Automation::bypass:
+            setParameter(processor, bypassParamID, 1.0f);
+            break;
+        case Automation::qualityNearest:
+            setParameter(processor, qualityParamID, float(Interpolation::nearest));
+            break;
+        case Automation::qualityHermite:
+            setParameter(processor, qualityParamID, float(Interpolation::hermite));
+            break;
+        case Automation::qualityLagrange:
+            setParameter(processor, qualityParamID, float(Interpolation::lagrange));
+            break;
+        case Automation::qualityAllpass:
+            setParameter(processor, qualityParamID, float(Interpolation::allpass));
+            break;
+        case Automation::crossfade:
+            setParameter(processor, timeChangeParamID, float(Parameters::crossfade));
+            break;
+        case Automation::tape:
+            setParameter(processor, timeChangeParamID, float(Parameters::tape));
+            break;
+        case Automation::taps:
+            setParameter(processor, tapCountParamID, float(Parameters::maxTaps));
+            break;
+        case Automation::modulation:
+            setParameter(processor, modDepthParamID, 5.0f);
+            setParameter(processor, modRateParamID, 2.0f);
+            break;
+        case Automation::drive:
+            setParameter(processor, driveParamID, 50.0f);
+            break;
+        case Automation::diffusion:
+            setParameter(processor, diffusionParamID, 70.0f);
+            break;
+        case Automation::freeze:
+            setParameter(processor, freezeParamID, 1.0f);
+            break;
+        case Automation::reverse:
+            setParameter(processor, reverseParamID, 1.0f);
+            break;
+        default:
+            break;
+    }
+}
+
+/** Mean, median & percentiles of the per-block timings */
+static ScenarioResult summarise(const juce::String& name, std::vector<double>& nsPerSample,
+                                juce::uint64 totalCycles, double totalSamples)
+{
+    ScenarioResult result;
+    result.name = name;
+    double sum = 0.0;
+    for(auto ns : nsPerSample)
+        sum += ns;
+    result.meanNs = sum / double(nsPerSample.size());
+
+    std::sort(nsPerSample.begin(), nsPerSample.end());
+    auto percentile = [&](double p){
+        return nsPerSample[std::min(nsPerSample.size() - 1, size_t(p * double(nsPerSample.size())))];
+    };
+    result.medianNs = percentile(0.5);
+    result.p95Ns = percentile(0.95);
+    result.p99Ns = percentile(0.99);
+    if(hasCycleCounter)
+        result.cyclesPerSample = double(totalCycles) / totalSamples;
+    return result;
+}
+
+static ScenarioResult runScenario(const Scenario& scenario, double seconds)
+{
+    DelayAudioProcessor processor;
+    juce::AudioProcessor::BusesLayout busesLayout;
+    busesLayout.inputBuses.add(juce::AudioChannelSet::canonicalChannelSet(scenario.layout.numInputs));
+    busesLayout.outputBuses.add(juce::AudioChannelSet::canonicalChannelSet(scenario.layout.numOutputs));
+    bool layoutOK = processor.setBusesLayout(busesLayout);
+    jassert(layoutOK);
+    juce::ignoreUnused(layoutOK);
+
+    // Parameters that make every stage do real work: feedback, stereo width & audible filters
+    setParameter(processor, feedbackParamID, 70.0f);
+    setParameter(processor, stereoParamID, 50.0f);
+    setParameter(processor, lowCutParamID, 120.0f);
+    setParameter(processor, highCutParamID, 8000.0f);
+    setUp(processor, scenario.automation);
+
+    FixedTempoPlayHead playHead;
+    processor.setPlayHead(&playHead);
+    processor.setRateAndBufferSizeDetails(scenario.sampleRate, scenario.blockSize);
+    processor.prepareToPlay(scenario.sampleRate, scenario.blockSize);
+
+    // Noise as input, the same every run
+    int numChannels = std::max(scenario.layout.numInputs, scenario.layout.numOutputs);
+    juce::AudioBuffer<float> noise(numChannels, scenario.blockSize);
+    juce::Random random(1234);
+    for(int ch = 0; ch < numChannels; ++ch)
+        for(int i = 0; i < scenario.blockSize; ++i)
+            noise.setSample(ch, i, random.nextFloat() * 0.5f - 0.25f);
+
+    juce::AudioBuffer<float> buffer(numChannels, scenario.blockSize);
+    juce::MidiBuffer midi;
+
+    int numWarmUpBlocks = int(0.25 * scenario.sampleRate) / scenario.blockSize + 1;
+    int numBlocks = int(seconds * scenario.sampleRate) / scenario.blockSize + 1;
+
+    std::vector<double> nsPerSample;
+    nsPerSample.reserve(size_t(numBlocks));
+    juce::uint64 totalCycles = 0;
+    double secondsPerTick = 1.0 / double(juce::Time::getHighResolutionTicksPerSecond());
+
+    for(int block = 0; block < numWarmUpBlocks + numBlocks; ++block){
+        buffer.makeCopyOf(noise, true);
+        automate(processor, scenario.automation, block);
+
+        auto startTicks = juce::Time::getHighResolutionTicks();
+        auto startCycles = readCycleCounter();
+        processor.processBlock(buffer, midi);
+        auto cycles = readCycleCounter() - startCycles;
+        auto ticks = juce::Time::getHighResolutionTicks() - startTicks;
+
+        if(block >= numWarmUpBlocks){
+            nsPerSample.push_back(double(ticks) * secondsPerTick * 1.0e9 / scenario.blockSize);
+            totalCycles += cycles;
+        }
+    }
+
+    processor.releaseResources();
+    return summarise(scenario.name, nsPerSample, totalCycles, double(numBlocks) * scenario.blockSize);
+}
+
+/** Times DelayLine::readBlock with one interpolation policy, on a stereo line like the plug-in's.
+    The delay moves like a slow modulation, so every read is fractional. */
+template<typename Interpolator>
+static ScenarioResult runReadScenario(const juce::String& name, int blockSize, double seconds)
+{
+    constexpr double sampleRate = 48000.0;
+    constexpr float depth = 100.0f;
+    float delay = float(blockSize) + 2.0f * depth;  // every read stays behind the block that's written
+
+    DelayLine<StereoSample> delayLine;
+    delayLine.setMaximumDelayInSamples(blockSize + 4 * int(depth));
+    delayLine.reset();
+    Interpolator interpolator;
+
+    auto numSamples = size_t(blockSize);
+    std::vector<StereoSample> input(numSamples), output(numSamples);
+    std::vector<float> delays(numSamples);
+    juce::Random random(1234);
+    for(auto& sample : input)
+        sample = { random.nextFloat() * 0.5f - 0.25f, random.nextFloat() * 0.5f - 0.25f };
+
+    int numWarmUpBlocks = int(0.25 * sampleRate) / blockSize + 1;
+    int numBlocks = int(seconds * sampleRate) / blockSize + 1;
+
+    std::vector<double> nsPerSample;
+    nsPerSample.reserve(size_t(numBlocks));
+    juce::uint64 totalCycles = 0;
+    double secondsPerTick = 1.0 / double(juce::Time::getHighResolutionTicksPerSecond());
+    double phase = 0.0, phaseInc = juce::MathConstants<double>::twoPi * 0.5 / sampleRate;
+
+    for(int block = 0; block < numWarmUpBlocks + numBlocks; ++block){
+        for(auto& d : delays){
+            d = delay + depth * float(std::sin(phase));
+            phase += phaseInc;
+        }
+
+        auto startTicks = juce::Time::getHighResolutionTicks();
+        auto startCycles = readCycleCounter();
+        delayLine.readBlock(interpolator, output.data(), delays.data(), blockSize);
+        auto cycles = readCycleCounter() - startCycles;
+        auto ticks = juce::Time::getHighResolutionTicks() - startTicks;
+        delayLine.writeBlock(input.data(), blockSize);
+
+        if(block >= numWarmUpBlocks){
+            nsPerSample.push_back(double(ticks) * secondsPerTick * 1.0e9 / blockSize);
+            totalCycles += cycles;
+        }
+    }
+    return summarise(name, nsPerSample, totalCycles, double(numBlocks) * blockSize);
+}
+
+static ScenarioResult runReadScenario(Interpolation::Type type, const juce::String& name, int blockSize, double seconds)
+{
+    switch(type){
+        case Interpolation::nearest:  return runReadScenario<Interpolation::Nearest<StereoSample>>(name, blockSize, seconds);
+        case Interpolation::hermite:  return runReadScenario<Interpolation::Hermite<StereoSample>>(name, blockSize, seconds);
+        case Interpolation::lagrange: return runReadScenario<Interpolation::Lagrange<StereoSample>>(name, blockSize, seconds);
+        case Interpolation::allpass:  return runReadScenario<Interpolation::Allpass<StereoSample>>(name, blockSize, seconds);
+        default:                      return runReadScenario<Interpolation::Linear<StereoSample>>(name, blockSize, seconds);
+    }
+}
+
+//==============================================================================
+static juce::Array<Scenario> createScenarios(const BenchmarkSettings& settings)
+{
+    juce::Array<Scenario> scenarios;
+    auto addIfSelected = [&](const Scenario& scenario){
+        bool selected = settings.filters.isEmpty();
+        for(auto& filter : settings.filters)
+            selected = selected || scenario.name.contains(filter);
+        if(selected)
+            scenarios.add(scenario);
+    };
+
+    for(auto sampleRate : settings.sampleRates)
+        for(auto blockSize : settings.blockSizes)
+            for(auto& layout : layouts)
+                for(int a = 0; a < int(std::size(automationNames)); ++a){
+                    Scenario scenario { {}, sampleRate, blockSize, layout, Automation(a) };
+                    scenario.name = juce::String(sampleRate / 1000.0, 1) + "kHz/" + juce::String(blockSize)
+                                  + "/" + layout.name + "/" + automationNames[a];
+                    addIfSelected(scenario);
+                }
+
+    // The reads alone don't depend on the sample rate or the bus layout
+    for(auto blockSize : settings.blockSizes)
+        for(int type = 0; type < int(std::size(interpolationNames)); ++type){
+            Scenario scenario { {}, 48000.0, blockSize, layouts[2], Automation::none, type };
+            scenario.name = "read/" + juce::String(blockSize) + "/" + interpolationNames[type];
+            addIfSelected(scenario);
+        }
+    return scenarios;
+}
+
+static juce::var toJSON(const juce::Array<ScenarioResult>& results)
+{
+    juce::Array<juce::var> list;
+    for(auto& result : results){
+        auto* object = new juce::DynamicObject();
+        object->setProperty("name", result.name);
+        object->setProperty("meanNsPerSample", result.meanNs);
+        object->setProperty("medianNsPerSample", result.medianNs);
+        object->setProperty("p95NsPerSample", result.p95Ns);
+        object->setProperty("p99NsPerSample", result.p99Ns);
+        object->setProperty("cyclesPerSample", result.cyclesPerSample);
+        list.add(juce::var(object));
+    }
+
+    auto* root = new juce::DynamicObject();
+    root->setProperty("cpu", juce::SystemStats::getCpuModel());
+    root->setProperty("juceVersion", juce::SystemStats::getJUCEVersion());
+    root->setProperty("results", list);
+    return juce::var(root);
+}
+
+/**
+    Compares the medians against a baseline written by --json. The median is the least noisy of the numbers.
+    Returns the number of scenarios that got slower than the tolerance allows.
+ */
+static int compareWithBaseline(const juce::Array<ScenarioResult>& results, const juce::File& baselineFile,
+                               double tolerance)
+{
+    auto baseline = juce::JSON::parse(baselineFile);
+    auto* baselineResults = baseline["results"].getArray();
+    if(baselineResults == nullptr){
+        std::cerr << "DelayBenchmark: " << baselineFile.getFullPathName() << " is not a benchmark result\n";
+        return 1;
+    }
+
+    std::cout << "\nCompared with " << baselineFile.getFullPathName() << " (tolerance " << tolerance << "%)\n";
+    int numRegressions = 0;
+    for(auto& result : results){
+        for(auto& old : *baselineResults){
+            if(old["name"].toString() != result.name)
+                continue;
+
+            double oldMedian = old["medianNsPerSample"];
+            double change = (result.medianNs / oldMedian - 1.0) * 100.0;
+            bool regressed = change > tolerance;
+            numRegressions += regressed ? 1 : 0;
+            std::cout << std::left << std::setw(48) << result.name << std::right << std::fixed
+                      << std::setprecision(2) << std::setw(9) << oldMedian << " -> " << std::setw(9)
+                      << result.medianNs << " ns/sample  " << std::showpos << std::setprecision(1) << change
+                      << std::noshowpos << "%" << (regressed ? "  REGRESSION" : "") << "\n";
+        }
+    }
+    return numRegressions;
+}
+
+//==============================================================================
+static void printUsage()
+{
+    std::cout <<
+        "Usage: DelayBenchmark [options]\n"
+        "Times processBlock over sample rates x block sizes x bus layouts x scenarios.\n"
+        "\n"
+        "  --sample-rates <list>     comma separated, default 44100,48000,96000,192000\n"
+        "  --block-sizes <list>      comma separated, default 16,64,256,1024,4096\n"
+        "  --filter <text>           only scenarios whose name contains the text (may repeat),\n"
+        "                            e.g. --filter /stereo/ --filter filter-sweep\n"
+        "  --seconds <s>             audio processed per scenario (default 2)\n"
+        "  --json <file>             write the results as JSON\n"
+        "  --baseline <file>         compare against a JSON file written by --json,\n"
+        "                            exits with 1 if a scenario got slower\n"
+        "  --tolerance <percent>     allowed slowdown against the baseline (default 10)\n"
+        "\n"
+        "Scenario names are <sample rate>/<block size>/<layout>/<scenario>, with layouts\n"
+        "mono, mono-stereo, stereo & scenarios static, delay-automation, filter-sweep,\n"
+        "tempo-sync, bypass, quality-nearest, quality-hermite, quality-lagrange,\n"
+        "quality-allpass (static is linear), crossfade-automation, tape-automation,\n"
+        "taps, modulation, drive, diffusion, freeze, reverse.\n"
+        "read/<block size>/<policy> times the delay line reads alone, with the policies\n"
+        "nearest, linear, hermite, lagrange, allpass.\n";
+}
+
+static juce::Result parseArguments(const juce::StringArray& args, BenchmarkSettings& settings)
+{
+    for(int i = 0; i < args.size(); ++i){
+        auto arg = args[i];
+        if(i + 1 >= args.size())
+            return juce::Result::fail("missing value for " + arg);
+        auto value = args[++i];
+
+        if(arg == "--sample-rates"){
+            settings.sampleRates.clear();
+            for(auto& rate : juce::StringArray::fromTokens(value, ",", ""))
+                if(rate.getDoubleValue() > 0.0)
+                    settings.sampleRates.add(rate.getDoubleValue());
+        }
+        else if(arg == "--block-sizes"){
+            settings.blockSizes.clear();
+            for(auto& size : juce::StringArray::fromTokens(value, ",", ""))
+                if(size.getIntValue() > 0)
+                    settings.blockSizes.add(size.getIntValue());
+        }
+        else if(arg == "--filter")
+            settings.filters.add(value);
+        else if(arg == "--seconds")
+            settings.seconds = std::max(0.01, value.getDoubleValue());
+        else if(arg == "--json")
+            settings.jsonOutput = juce::File::getCurrentWorkingDirectory().getChildFile(value);
+        else if(arg == "--baseline")
+            settings.baseline = juce::File::getCurrentWorkingDirectory().getChildFile(value);
+        else if(arg == "--tolerance")
+            settings.tolerance = value.getDoubleValue();
+        else
+            return juce::Result::fail("unknown option " + arg);
+    }
+
+    if(settings.sampleRates.isEmpty() || settings.blockSizes.isEmpty())
+        return juce::Result::fail("no sample rates or block sizes");
+    return juce::Result::ok();
+}
+
+int main(int argc, char* argv[])
+{
+    // The parameters' timers & the tail length updates need a message manager, nothing else of the GUI
+    juce::MessageManager::getInstance();
+    const juce::ScopeGuard deleteMessageManager { [] { juce::MessageManager::deleteInstance(); } };
+
+    juce::StringArray args;
+    for(int i = 1; i < argc; ++i)
+        args.add(juce::CharPointer_UTF8(argv[i]));
+
+    if(args.contains("-h") || args.contains("--help")){
+        printUsage();
+        return 0;
+    }
+
+    BenchmarkSettings settings;
+    auto parsed = parseArguments(args, settings);
+    if(parsed.failed()){
+        std::cerr << "DelayBenchmark: " << parsed.getErrorMessage() << "\n\n";
+        printUsage();
+        return 1;
+    }
+
+    auto scenarios = createScenarios(settings);
+    std::cout << juce::SystemStats::getCpuModel() << ", " << juce::SystemStats::getJUCEVersion() << "\n"
+              << scenarios.size() << " scenarios, " << settings.seconds << " s of audio each\n\n"
+              << std::left << std::setw(48) << "scenario" << std::right
+              << std::setw(10) << "mean" << std::setw(10) << "median" << std::setw(10) << "p95"
+              << std::setw(10) << "p99" << std::setw(12) << "cycles" << "\n";
+
+    juce::Array<ScenarioResult> results;
+    for(auto& scenario : scenarios){
+        auto result = scenario.interpolation >= 0
+                    ? runReadScenario(Interpolation::Type(scenario.interpolation), scenario.name,
+                                      scenario.blockSize, settings.seconds)
+                    : runScenario(scenario, settings.seconds);
+        results.add(result);
+
+        std::cout << std::left << std::setw(48) << result.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(10) << result.meanNs << std::setw(10) << result.medianNs
+                  << std::setw(10) << result.p95Ns << std::setw(10) << result.p99Ns << std::setw(12);
+        if(result.cyclesPerSample >= 0.0)
+            std::cout << result.cyclesPerSample << "\n";
+        else
+            std::cout << "n/a" << "\n";
+    }
+    std::cout << "(ns/sample & cycles/sample)\n";
+
+    if(settings.jsonOutput != juce::File()){
+        if(!settings.jsonOutput.replaceWithText(juce::JSON::toString(toJSON(results)))){
+            std::cerr << "DelayBenchmark: can't write " << settings.jsonOutput.getFullPathName() << "\n";
+            return 1;
+        }
+    }
+
+    if(settings.baseline != juce::File())
+        return compareWithBaseline(results, settings.baseline, settings.tolerance) > 0 ? 1 : 0;
+    return 0;
+}
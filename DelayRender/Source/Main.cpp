@@ -0,0 +1,310 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    DelayRender: renders audio files offline through DelayAudioProcessor.
+    No GUI & no audio device, so it runs fine on a headless Linux server.
+
+    Every file is a job on a thread pool & every job gets its own processor instance,
+    so files render in parallel without sharing any state.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "../../Delay/Source/PluginProcessor.h"
+
+//==============================================================================
+/** Everything that was set on the command line, shared (read-only) by all jobs */
+struct RenderSettings
+{
+    juce::File outputFolder;          // empty: write next to the input file
+    juce::File preset;                // XML state, as saved by DelayAudioProcessor::getStateInformation
+    juce::StringPairArray parameters; // parameter ID -> value, applied after the preset
+    int blockSize = 512;
+    int numJobs = juce::SystemStats::getNumCpus();
+    double tailSeconds = 0.0;         // extra time rendered after the input, so the repeats can die out
+    double bpm = 120.0;               // tempo seen by Tempo Sync
+};
+
+/** Tells the processor the tempo, there's no host to ask */
+class FixedTempoPlayHead : public juce::AudioPlayHead
+{
+public:
+    explicit FixedTempoPlayHead(double tempo) : bpm(tempo) {}
+
+    juce::Optional<PositionInfo> getPosition() const override
+    {
+        PositionInfo info;
+        info.setBpm(bpm);
+        info.setIsPlaying(true);
+        return info;
+    }
+
+private:
+    double bpm;
+};
+
+//==============================================================================
+static void printUsage()
+{
+    std::cout <<
+        "Usage: DelayRender [options] <input files...>\n"
+        "Renders WAV, AIFF & FLAC files through the delay.\n"
+        "\n"
+        "  -o, --output <folder>     where to write the rendered files\n"
+        "                            (default: next to the input, as <name>-delay.<ext>)\n"
+        "  -p, --preset <file>       load a preset (the plug-in's state as XML)\n"
+        "  -s, --set <id>=<value>    set a parameter, e.g. --set delayTime=250 --set delayNote=1/4\n"
+        "                            numbers are in the parameter's own units, anything else is\n"
+        "                            parsed like text typed into the plug-in\n"
+        "  -b, --block-size <n>      samples per processBlock call (default 512)\n"
+        "  -j, --jobs <n>            files rendered at the same time (default: number of CPUs)\n"
+        "  -t, --tail <seconds>      render this much longer than the input (default 0)\n"
+        "      --bpm <tempo>         tempo for Tempo Sync (default 120)\n"
+        "\n"
+        "Parameter IDs: gain, delayTime, mix, feedback, stereo, lowCut, highCut,\n"
+        "               tempoSync, delayNote, bypass, quality, bypassMode,\n"
+        "               timeChange, taps, swing, modRate, modDepth, modShape,\n"
+        "               modPhase, modSync, modNote, diffusion, drive,\n"
+        "               freeze, reverse,\n"
+        "               tap<n>Time, tap<n>Note, tap<n>Level, tap<n>Pan (n = 1 - 8)\n";
+}
+
+/** Fills in settings & inputs from the command line. Returns a failed result for bad arguments. */
+static juce::Result parseArguments(const juce::StringArray& args, RenderSettings& settings,
+                                   juce::Array<juce::File>& inputs)
+{
+    for(int i = 0; i < args.size(); ++i){
+        auto arg = args[i];
+
+        // Every option takes exactly one value
+        auto nextValue = [&](juce::String& value){
+            if(i + 1 >= args.size())
+                return false;
+            value = args[++i];
+            return true;
+        };
+
+        juce::String value;
+        if(arg == "-o" || arg == "--output"){
+            if(!nextValue(value)) return juce::Result::fail(arg + " needs a folder");
+            settings.outputFolder = juce::File::getCurrentWorkingDirectory().getChildFile(value);
+        }
+        else if(arg == "-p" || arg == "--preset"){
+            if(!nextValue(value)) return juce::Result::fail(arg + " needs a file");
+            settings.preset = juce::File::getCurrentWorkingDirectory().getChildFile(value);
+        }
+        else if(arg == "-s" || arg == "--set"){
+            if(!nextValue(value) || !value.contains("="))
+                return juce::Result::fail(arg + " needs <id>=<value>");
+            settings.parameters.set(value.upToFirstOccurrenceOf("=", false, false).trim(),
+                                    value.fromFirstOccurrenceOf("=", false, false).trim());
+        }
+        else if(arg == "-b" || arg == "--block-size"){
+            if(!nextValue(value) || value.getIntValue() < 1)
+                return juce::Result::fail(arg + " needs a number of samples");
+            settings.blockSize = value.getIntValue();
+        }
+        else if(arg == "-j" || arg == "--jobs"){
+            if(!nextValue(value) || value.getIntValue() < 1)
+                return juce::Result::fail(arg + " needs a number of jobs");
+            settings.numJobs = value.getIntValue();
+        }
+        else if(arg == "-t" || arg == "--tail"){
+            if(!nextValue(value) || value.getDoubleValue() < 0.0)
+                return juce::Result::fail(arg + " needs a number of seconds");
+            settings.tailSeconds = value.getDoubleValue();
+        }
+        else if(arg == "--bpm"){
+            if(!nextValue(value) || value.getDoubleValue() <= 0.0)
+                return juce::Result::fail(arg + " needs a tempo");
+            settings.bpm = value.getDoubleValue();
+        }
+        else if(arg.startsWith("-")){
+            return juce::Result::fail("unknown option " + arg);
+        }
+        else{
+            inputs.add(juce::File::getCurrentWorkingDirectory().getChildFile(arg));
+        }
+    }
+
+    if(inputs.isEmpty())
+        return juce::Result::fail("no input files");
+    return juce::Result::ok();
+}
+
+static juce::File outputFileFor(const juce::File& input, const RenderSettings& settings)
+{
+    if(settings.outputFolder != juce::File())
+        return settings.outputFolder.getChildFile(input.getFileName());
+    return input.getSiblingFile(input.getFileNameWithoutExtension() + "-delay" + input.getFileExtension());
+}
+
+//==============================================================================
+/** Loads the preset & sets the parameters given on the command line */
+static juce::Result applySettings(DelayAudioProcessor& processor, const RenderSettings& settings)
+{
+    if(settings.preset != juce::File()){
+        auto xml = juce::parseXML(settings.preset);
+        if(xml == nullptr || !xml->hasTagName(processor.apvts.state.getType()))
+            return juce::Result::fail(settings.preset.getFullPathName() + " is not a preset");
+        processor.apvts.replaceState(juce::ValueTree::fromXml(*xml));
+    }
+
+    auto& ids = settings.parameters.getAllKeys();
+    auto& values = settings.parameters.getAllValues();
+    for(int i = 0; i < ids.size(); ++i){
+        auto* param = processor.apvts.getParameter(ids[i]);
+        if(param == nullptr)
+            return juce::Result::fail("unknown parameter " + ids[i]);
+
+        // Plain numbers are in the parameter's units (ms, %, Hz, choice index), anything else is text like "1/4"
+        auto text = values[i];
+        bool isNumber = text.isNotEmpty() && text.containsOnly("0123456789.-+");
+        float normalised = isNumber ? param->convertTo0to1(text.getFloatValue())
+                                    : param->getValueForText(text);
+        param->setValueNotifyingHost(normalised);
+    }
+    return juce::Result::ok();
+}
+
+/** Renders one file with a processor of its own. Called from the worker threads. */
+static juce::Result renderFile(const juce::File& input, const juce::File& output, const RenderSettings& settings)
+{
+    // One format manager per job, so no reader or writer is shared between threads
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(input));
+    if(reader == nullptr)
+        return juce::Result::fail("can't read " + input.getFullPathName());
+
+    int numChannels = int(reader->numChannels);
+    if(numChannels != 1 && numChannels != 2)
+        return juce::Result::fail("only mono & stereo files are supported");
+
+    auto* format = formatManager.findFormatForFileExtension(output.getFileExtension());
+    if(format == nullptr)
+        return juce::Result::fail("can't write " + output.getFileExtension() + " files");
+
+    // Same layout as the file: mono -> mono or stereo -> stereo
+    DelayAudioProcessor processor;
+    auto channelSet = juce::AudioChannelSet::canonicalChannelSet(numChannels);
+    juce::AudioProcessor::BusesLayout layout;
+    layout.inputBuses.add(channelSet);
+    layout.outputBuses.add(channelSet);
+    if(!processor.setBusesLayout(layout))
+        return juce::Result::fail("bus layout not supported");
+
+    auto result = applySettings(processor, settings);
+    if(result.failed())
+        return result;
+
+    FixedTempoPlayHead playHead(settings.bpm);
+    processor.setPlayHead(&playHead);
+    processor.setNonRealtime(true);
+    processor.setRateAndBufferSizeDetails(reader->sampleRate, settings.blockSize);
+    processor.prepareToPlay(reader->sampleRate, settings.blockSize);
+
+    // Keep the bit depth of the input if the output format can do it
+    auto bitDepths = format->getPossibleBitDepths();
+    int bitsPerSample = bitDepths.contains(int(reader->bitsPerSample)) ? int(reader->bitsPerSample)
+                                                                      : bitDepths.getLast();
+
+    output.deleteFile();
+    auto stream = std::make_unique<juce::FileOutputStream>(output);
+    if(stream->failedToOpen())
+        return juce::Result::fail("can't write " + output.getFullPathName());
+
+    std::unique_ptr<juce::AudioFormatWriter> writer(format->createWriterFor(stream.get(), reader->sampleRate,
+                                                                            juce::uint32(numChannels), bitsPerSample,
+                                                                            reader->metadataValues, 0));
+    if(writer == nullptr)
+        return juce::Result::fail("can't write " + output.getFullPathName());
+    stream.release(); // the writer owns the stream now
+
+    juce::AudioBuffer<float> buffer(numChannels, settings.blockSize);
+    juce::MidiBuffer midi;
+    auto totalLength = reader->lengthInSamples + juce::int64(settings.tailSeconds * reader->sampleRate);
+
+    for(juce::int64 position = 0; position < totalLength; position += settings.blockSize){
+        int numSamples = int(std::min<juce::int64>(settings.blockSize, totalLength - position));
+        buffer.setSize(numChannels, numSamples, false, false, true);
+
+        // Past the end of the file the reader fills in silence, which renders the tail
+        reader->read(&buffer, 0, numSamples, position, true, true);
+        processor.processBlock(buffer, midi);
+
+        if(!writer->writeFromAudioSampleBuffer(buffer, 0, numSamples))
+            return juce::Result::fail("error writing " + output.getFullPathName());
+    }
+
+    processor.releaseResources();
+    return juce::Result::ok();
+}
+
+//==============================================================================
+int main(int argc, char* argv[])
+{
+    // The parameters' timers & the tail length updates need a message manager, nothing else of the GUI
+    juce::MessageManager::getInstance();
+    const juce::ScopeGuard deleteMessageManager { [] { juce::MessageManager::deleteInstance(); } };
+
+    juce::StringArray args;
+    for(int i = 1; i < argc; ++i)
+        args.add(juce::CharPointer_UTF8(argv[i]));
+
+    if(args.isEmpty() || args.contains("-h") || args.contains("--help")){
+        printUsage();
+        return args.isEmpty() ? 1 : 0;
+    }
+
+    RenderSettings settings;
+    juce::Array<juce::File> inputs;
+    auto result = parseArguments(args, settings, inputs);
+    if(result.failed()){
+        std::cerr << "DelayRender: " << result.getErrorMessage() << "\n\n";
+        printUsage();
+        return 1;
+    }
+
+    if(settings.outputFolder != juce::File() && !settings.outputFolder.createDirectory()){
+        std::cerr << "DelayRender: can't create " << settings.outputFolder.getFullPathName() << "\n";
+        return 1;
+    }
+
+    juce::ThreadPool pool(settings.numJobs);
+    juce::CriticalSection printLock;
+    std::atomic<int> numFailed { 0 };
+
+    for(auto& input : inputs){
+        auto output = outputFileFor(input, settings);
+        if(output == input){
+            std::cerr << input.getFullPathName() << ": output would overwrite the input, skipped\n";
+            ++numFailed;
+            continue;
+        }
+
+        pool.addJob([input, output, &settings, &printLock, &numFailed]{
+            auto start = juce::Time::getMillisecondCounterHiRes();
+            auto jobResult = renderFile(input, output, settings);
+            auto seconds = (juce::Time::getMillisecondCounterHiRes() - start) / 1000.0;
+
+            const juce::ScopedLock lock(printLock);
+            if(jobResult.wasOk())
+                std::cout << output.getFullPathName() << " (" << juce::String(seconds, 2) << " s)\n";
+            else{
+                std::cerr << input.getFullPathName() << ": " << jobResult.getErrorMessage() << "\n";
+                ++numFailed;
+            }
+        });
+    }
+
+    // The pool's destructor would interrupt running jobs, wait for them to finish first
+    while(pool.getNumJobs() > 0)
+        juce::Thread::sleep(20);
+
+    return numFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+/*
+  ==============================================================================
+
+    InterpolationChecks.cpp
+    Frequency response of every interpolation policy, run by DelayTests.
+
+    A least-squares fit splits the output of a sine through a DelayLine into the expected sine & the rest:
+        Droop     level of the sine with a static delay of half a sample
+        Aliasing  level of the rest while the delay moves by 2% of a sample per sample
+    at fs / 16 & fs / 4. The figures are the ones in Interpolation.h.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <vector>
+#include "../../Delay/Source/DelayLine.h"
+
+namespace
+{
+    /** What a policy should measure, in dB. The aliasing limits have about 1.5 dB of room. */
+    struct Expected
+    {
+        double droopLow, droopHigh;         // at fs / 16 & fs / 4, +-0.1 dB
+        double aliasingLow, aliasingHigh;   // upper limits at fs / 16 & fs / 4
+    };
+
+    struct Measurement
+    {
+        double levelDb = 0.0;     // the sine, relative to the input
+        double residualDb = 0.0;  // everything else, relative to the sine
+    };
+
+    /** Least-squares fit of a sine at omega (radians per sample) */
+    Measurement fitSine(const std::vector<float>& y, double omega)
+    {
+        double cc = 0.0, cs = 0.0, ss = 0.0, yc = 0.0, ys = 0.0;
+        for(size_t i = 0; i < y.size(); ++i){
+            double c = std::cos(omega * double(i));
+            double s = std::sin(omega * double(i));
+            cc += c * c;
+            cs += c * s;
+            ss += s * s;
+            yc += y[i] * c;
+            ys += y[i] * s;
+        }
+        double determinant = cc * ss - cs * cs;
+        double a = (yc * ss - ys * cs) / determinant;
+        double b = (ys * cc - yc * cs) / determinant;
+
+        double residual = 0.0;
+        for(size_t i = 0; i < y.size(); ++i){
+            double error = y[i] - a * std::cos(omega * double(i)) - b * std::sin(omega * double(i));
+            residual += error * error;
+        }
+        double sinePower = (a * a + b * b) * 0.5 * double(y.size());
+
+        Measurement result;
+        result.levelDb = 10.0 * std::log10(2.0 * sinePower / double(y.size()));
+        result.residualDb = 10.0 * std::log10(residual / sinePower + 1.0e-30);
+        return result;
+    }
+
+    /** Sends a sine of frequency (relative to the sample rate) through a delay line.
+        The delay starts at 20.5 samples & grows by delayRate every sample. */
+    template<typename Interpolator>
+    Measurement measure(double frequency, double delayRate)
+    {
+        constexpr int numWarmUp = 512;
+        constexpr int numSamples = 8192;
+
+        DelayLine<float> delayLine;
+        delayLine.setMaximumDelayInSamples(numWarmUp + numSamples);
+        delayLine.reset();
+        Interpolator interpolator;
+
+        double omega = juce::MathConstants<double>::twoPi * frequency;
+        std::vector<float> output;
+        output.reserve(size_t(numSamples));
+        for(int n = 0; n < numWarmUp + numSamples; ++n){
+            delayLine.write(float(std::sin(omega * double(n))));
+            float delay = float(20.5 + delayRate * double(n));
+            float y = delayLine.read(interpolator, delay);
+            if(n >= numWarmUp)
+                output.push_back(y);
+        }
+
+        // A growing delay plays the buffer back slower, the sine comes out lower by the same ratio
+        return fitSine(output, omega * (1.0 - delayRate));
+    }
+}
+
+//==============================================================================
+class InterpolationChecks : public juce::UnitTest
+{
+public:
+    InterpolationChecks() : juce::UnitTest("Interpolation", "Delay") {}
+
+    void runTest() override
+    {
+        check<Interpolation::Nearest<float>>("Nearest",   { 0.0,   0.0,  -17.5,  -5.0 });
+        check<Interpolation::Linear<float>>("Linear",     { -0.17, -3.0, -43.0, -17.0 });
+        check<Interpolation::Hermite<float>>("Hermite",   { 0.0,   -1.1, -61.0, -22.0 });
+        check<Interpolation::Lagrange<float>>("Lagrange", { 0.0,   -1.1, -74.0, -26.0 });
+        check<Interpolation::Allpass<float>>("Allpass",   { 0.0,   0.0,  -46.0, -14.0 });
+    }
+
+private:
+    template<typename Interpolator>
+    void check(const juce::String& name, const Expected& expected)
+    {
+        beginTest(name);
+        constexpr double low = 1.0 / 16.0, high = 1.0 / 4.0;
+
+        auto droopLow = measure<Interpolator>(low, 0.0).levelDb;
+        auto droopHigh = measure<Interpolator>(high, 0.0).levelDb;
+        auto aliasingLow = measure<Interpolator>(low, 0.02).residualDb;
+        auto aliasingHigh = measure<Interpolator>(high, 0.02).residualDb;
+        logMessage(name + ": droop " + juce::String(droopLow, 2) + " / " + juce::String(droopHigh, 2)
+                   + " dB, aliasing " + juce::String(aliasingLow, 1) + " / " + juce::String(aliasingHigh, 1) + " dB");
+
+        expectWithinAbsoluteError(droopLow, expected.droopLow, 0.1, "droop at fs / 16");
+        expectWithinAbsoluteError(droopHigh, expected.droopHigh, 0.1, "droop at fs / 4");
+        expectLessOrEqual(aliasingLow, expected.aliasingLow, "aliasing at fs / 16");
+        expectLessOrEqual(aliasingHigh, expected.aliasingHigh, "aliasing at fs / 4");
+    }
+};
+
+static InterpolationChecks interpolationChecks;
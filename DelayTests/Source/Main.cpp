@@ -0,0 +1,28 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    DelayTests: runs the juce::UnitTests of the "Delay" category (the *Checks.cpp files).
+    Exits with 1 if one of them fails, so it can gate a build script or CI job.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+
+//==============================================================================
+int main()
+{
+    // The parameters' timers & the tail length updates need a message manager, nothing else of the GUI
+    juce::MessageManager::getInstance();
+    const juce::ScopeGuard deleteMessageManager { [] { juce::MessageManager::deleteInstance(); } };
+
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure(false);
+    runner.runTestsInCategory("Delay");
+
+    int numFailures = 0;
+    for(int i = 0; i < runner.getNumResults(); ++i)
+        numFailures += runner.getResult(i)->failures;
+    return numFailures > 0 ? 1 : 0;
+}
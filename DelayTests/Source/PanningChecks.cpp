@@ -0,0 +1,75 @@
+/*
+  ==============================================================================
+
+    PanningChecks.cpp
+    panningEqualPowerFast() against std::cos & std::sin, run by DelayTests.
+
+    Sweeps the whole range in steps of 1 / 10000 against the exact pan law in double. The block
+    version may differ from the scalar one by a float epsilon, e.g. when FMA fuses it differently.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <limits>
+#include <vector>
+#include "../../Delay/Source/DSP.h"
+
+class PanningChecks : public juce::UnitTest
+{
+public:
+    PanningChecks() : juce::UnitTest("Panning", "Delay") {}
+
+    void runTest() override
+    {
+        constexpr int numSteps = 20000;
+        std::vector<float> panning;
+        for(int i = 0; i <= numSteps; ++i)
+            panning.push_back(-1.0f + 2.0f * float(i) / float(numSteps));
+        jassert(panning.front() == -1.0f && panning[numSteps / 2] == 0.0f && panning.back() == 1.0f);
+
+        beginTest("Scalar against std::cos & std::sin");
+        double maxError = 0.0, maxPowerError = 0.0;
+        for(auto p : panning){
+            float left, right;
+            panningEqualPowerFast(p, left, right);
+            double theta = juce::MathConstants<double>::pi / 4.0 * (double(p) + 1.0);
+            maxError = std::max({ maxError, std::abs(left - std::cos(theta)), std::abs(right - std::sin(theta)) });
+            maxPowerError = std::max(maxPowerError, std::abs(double(left) * left + double(right) * right - 1.0));
+        }
+        logMessage("largest error " + juce::String(maxError, 10) + ", power " + juce::String(maxPowerError, 10));
+        expectLessOrEqual(maxError, 4.0e-7, "gain error");
+        expectLessOrEqual(maxPowerError, 1.0e-6, "power error");
+
+        beginTest("Endpoints");
+        float left, right;
+        panningEqualPowerFast(-1.0f, left, right);
+        expectWithinAbsoluteError(left, 1.0f, 4.0e-7f, "left gain, fully left");
+        expectWithinAbsoluteError(right, 0.0f, 4.0e-7f, "right gain, fully left");
+        panningEqualPowerFast(1.0f, left, right);
+        expectWithinAbsoluteError(left, 0.0f, 4.0e-7f, "left gain, fully right");
+        expectWithinAbsoluteError(right, 1.0f, 4.0e-7f, "right gain, fully right");
+        panningEqualPowerFast(0.0f, left, right);
+        expectEquals(left, right, "center");
+
+        beginTest("Block against scalar");
+        auto numSamples = int(panning.size());
+        std::vector<float> blockLeft(panning.size()), blockRight(panning.size());
+        panningEqualPowerFast(panning.data(), blockLeft.data(), blockRight.data(), numSamples);
+
+        // In place: the left gains overwrite the panning values
+        std::vector<float> inPlace(panning);
+        std::vector<float> inPlaceRight(panning.size());
+        panningEqualPowerFast(inPlace.data(), inPlace.data(), inPlaceRight.data(), numSamples);
+
+        float maxDifference = 0.0f;
+        for(size_t i = 0; i < panning.size(); ++i){
+            panningEqualPowerFast(panning[i], left, right);
+            maxDifference = std::max({ maxDifference, std::abs(blockLeft[i] - left), std::abs(blockRight[i] - right),
+                                       std::abs(inPlace[i] - left), std::abs(inPlaceRight[i] - right) });
+        }
+        expectLessOrEqual(maxDifference, std::numeric_limits<float>::epsilon(), "block against scalar");
+    }
+};
+
+static PanningChecks panningChecks;
@@ -0,0 +1,78 @@
+/*
+  ==============================================================================
+
+    SaturatorChecks.cpp
+    Drive at high frequencies & its makeup gain, run by DelayTests.
+
+    Measures the fundamental of sines through the Saturator at 48 kHz: a loud one near fs / 2 has to
+    be squashed like a low one & a quiet one has to come out with the makeup gain.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <vector>
+#include "../../Delay/Source/Saturator.h"
+
+namespace
+{
+    /** Level of the fundamental in dB, after 4800 samples to settle */
+    float saturatedLevel(float frequency, float amplitude, float drive)
+    {
+        constexpr double sampleRate = 48000.0;
+        constexpr int numSamples = 4800;  // whole cycles of every frequency below
+        constexpr int blockSize = 64;
+
+        Saturator saturator;
+        Parameters::Ramp ramp{ nullptr, drive, true };
+        std::vector<StereoSample> samples(size_t(2 * numSamples));
+        for(size_t i = 0; i < samples.size(); ++i){
+            float x = amplitude * float(std::sin(juce::MathConstants<double>::twoPi * frequency * double(i) / sampleRate));
+            samples[i] = { x, -x };
+        }
+        for(int start = 0; start < int(samples.size()); start += blockSize)
+            saturator.process(samples.data() + start, ramp, blockSize);
+
+        double re = 0.0, im = 0.0;
+        for(int i = 0; i < numSamples; ++i){
+            double phase = juce::MathConstants<double>::twoPi * frequency * double(i) / sampleRate;
+            re += samples[size_t(numSamples + i)].left * std::cos(phase);
+            im += samples[size_t(numSamples + i)].left * std::sin(phase);
+        }
+        return juce::Decibels::gainToDecibels(float(2.0 * std::sqrt(re * re + im * im) / numSamples), -200.0f);
+    }
+}
+
+//==============================================================================
+class SaturatorChecks : public juce::UnitTest
+{
+public:
+    SaturatorChecks() : juce::UnitTest("Saturator", "Delay") {}
+
+    void runTest() override
+    {
+        beginTest("Loud highs are squashed like loud lows");
+        for(float drive : { 0.5f, 1.0f }){
+            float low = saturatedLevel(1000.0f, 1.0f, drive);
+            float high = saturatedLevel(20000.0f, 1.0f, drive);
+            logMessage("Drive " + juce::String(drive) + ": 1 kHz " + juce::String(low, 2) + " dB, 20 kHz "
+                       + juce::String(high, 2) + " dB");
+            expectLessOrEqual(std::abs(high - low), 2.0f, "20 kHz against 1 kHz");
+        }
+
+        beginTest("100% Drive doesn't dull the repeats");
+        float makeup = juce::Decibels::gainToDecibels(Saturator::quietGain(1.0f));
+        for(float frequency : { 1000.0f, 15000.0f, 20000.0f }){
+            float quiet = saturatedLevel(frequency, 0.01f, 1.0f) + 40.0f;
+            logMessage(juce::String(frequency, 0) + " Hz at -40 dB: " + juce::String(quiet, 2) + " dB");
+            expectWithinAbsoluteError(quiet, makeup, 0.1f, "quiet sine gets the makeup gain");
+        }
+        float medium = saturatedLevel(1000.0f, 0.25f, 1.0f) + 12.0f;
+        float full = saturatedLevel(1000.0f, 1.0f, 1.0f);
+        logMessage("-12 dB sine: " + juce::String(medium, 2) + " dB, full scale: " + juce::String(full, 2) + " dB");
+        expectWithinAbsoluteError(medium, 0.0f, 1.0f, "-12 dB sine");
+        expectGreaterThan(full, -10.0f, "full scale sine");
+    }
+};
+
+static SaturatorChecks saturatorChecks;
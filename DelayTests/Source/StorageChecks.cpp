@@ -0,0 +1,121 @@
+/*
+  ==============================================================================
+
+    StorageChecks.cpp
+    Noise & clipping of the compact delay-line formats, run by DelayTests.
+
+    A 997 Hz sine goes through pack() & unpack(), also stored over & over with feedback like a steady
+    tone in the delay line, & over a 4096-sample loop the dither must not repeat with. Levels are
+    relative to a full scale sine. The figures are the ones DelayStorage.h & the README promise.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <vector>
+#include "../../Delay/Source/DelayStorage.h"
+
+namespace
+{
+    struct Measurement
+    {
+        double noiseDb = 0.0;  // relative to a full scale sine
+        double snrDb = 0.0;    // relative to the signal
+        float peak = 0.0f;     // of what came back out
+    };
+
+    /** Stores numSamples of a sine at levelDb numTrips times, feeding back feedback of what was stored before.
+        numSamples is the length of the loop, like the delay time of the delay line */
+    template<typename Storage>
+    Measurement roundTrip(double levelDb, float feedback = 0.0f, int numTrips = 1, int numSamples = 48000)
+    {
+        Storage storage;
+        std::vector<typename Storage::Word> words(numSamples);
+        std::vector<float> input(numSamples), stored(numSamples), exact(numSamples);
+
+        double amplitude = juce::Decibels::decibelsToGain(levelDb, -200.0);
+        for(int i = 0; i < numSamples; ++i)
+            input[size_t(i)] = float(amplitude * std::sin(juce::MathConstants<double>::twoPi * 997.0 / 48000.0 * i));
+
+        for(int trip = 0; trip < numTrips; ++trip){
+            for(size_t i = 0; i < input.size(); ++i){
+                stored[i] = input[i] + feedback * stored[i];
+                exact[i] = input[i] + feedback * exact[i];
+            }
+            storage.pack(stored.data(), words.data(), numSamples);
+            Storage::unpack(words.data(), stored.data(), numSamples);
+        }
+
+        double noise = 0.0, signal = 0.0;
+        Measurement result;
+        for(size_t i = 0; i < input.size(); ++i){
+            double error = double(stored[i]) - double(exact[i]);
+            noise += error * error;
+            signal += double(exact[i]) * exact[i];
+            result.peak = std::max(result.peak, std::abs(stored[i]));
+        }
+        result.noiseDb = 10.0 * std::log10(noise / (0.5 * numSamples) + 1.0e-30);
+        result.snrDb = 10.0 * std::log10(signal / (noise + 1.0e-30));
+        return result;
+    }
+
+    double dB(double powerRatio) { return 10.0 * std::log10(powerRatio); }
+}
+
+//==============================================================================
+class StorageChecks : public juce::UnitTest
+{
+public:
+    StorageChecks() : juce::UnitTest("Delay line storage", "Delay") {}
+
+    void runTest() override
+    {
+        using DelayStorage::Half;
+        using DelayStorage::Dithered16;
+
+        beginTest("Half: about 70 dB below the signal at any level");
+        for(double level : { 20.0, 0.0, -20.0, -40.0, -60.0, -84.0 }){
+            auto snr = roundTrip<Half>(level).snrDb;
+            logMessage("Half at " + juce::String(level) + " dB: SNR " + juce::String(snr, 1) + " dB");
+            expectGreaterOrEqual(snr, 68.0, "SNR at " + juce::String(level) + " dB");
+        }
+
+        beginTest("Dithered16: noise floor about 81 dB below full scale");
+        for(double level : { 0.0, -20.0, -40.0 }){
+            auto noise = roundTrip<Dithered16>(level).noiseDb;
+            logMessage("Dithered16 at " + juce::String(level) + " dB: noise " + juce::String(noise, 1) + " dB");
+            expectWithinAbsoluteError(noise, -81.0, 1.0, "noise floor at " + juce::String(level) + " dB");
+        }
+
+        beginTest("Dithered16: clips above +12 dBFS");
+        auto belowClip = roundTrip<Dithered16>(12.0);
+        expectGreaterOrEqual(belowClip.snrDb, 90.0, "+12 dBFS still clean");
+        auto aboveClip = roundTrip<Dithered16>(13.0);
+        expectWithinAbsoluteError(aboveClip.peak, Dithered16::headroom, 1.0e-3f, "+13 dBFS clipped at the headroom");
+        expectLessOrEqual(aboveClip.snrDb, 30.0, "+13 dBFS distorted");
+
+        // A steady tone in the feedback loop, at the level where it settles at -6 dBFS
+        beginTest("Feedback");
+        for(float feedback : { 0.5f, 0.9f }){
+            double level = -6.0 + 20.0 * std::log10(1.0 - feedback);
+            double louder = dB(1.0 / (1.0 - double(feedback) * feedback));
+
+            // The dither is random, so its noise adds up in power: 1 / (1 - f^2)
+            auto dithered = roundTrip<Dithered16>(level, feedback, 200).noiseDb;
+            logMessage("Dithered16, " + juce::String(feedback) + " feedback: noise " + juce::String(dithered, 1) + " dB");
+            expectWithinAbsoluteError(dithered, -81.0 + louder, 1.5, "dithered noise with feedback");
+            auto aligned = roundTrip<Dithered16>(level, feedback, 200, 4096).noiseDb;
+            logMessage("Dithered16, " + juce::String(feedback) + " feedback, 4096 samples: noise "
+                       + juce::String(aligned, 1) + " dB");
+            expectWithinAbsoluteError(aligned, -81.0 + louder, 1.5, "dithered noise with feedback, 4096 samples");
+
+            // Half floats round a repeating tone the same way every trip, so the error adds up like the echoes do
+            auto half = roundTrip<Half>(level, feedback, 200).snrDb;
+            double expected = 70.0 - 20.0 * std::log10(1.0 / (1.0 - feedback));
+            logMessage("Half, " + juce::String(feedback) + " feedback: SNR " + juce::String(half, 1) + " dB");
+            expectGreaterOrEqual(half, expected - 5.0, "half float SNR with feedback");
+        }
+    }
+};
+
+static StorageChecks storageChecks;